@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "access_log.hpp"
+#include "metrics.hpp"
+
+// The writer flushes once this much is formatted, and otherwise wakes up this often
+static const size_t kBatchBytes = 64 * 1024;
+static const std::chrono::milliseconds kWriterInterval(10);
+
+bool AccessLogRing::push(const AccessRecord& record) {
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  if(t - head.load(std::memory_order_acquire) == kCapacity) {
+    dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+  }
+  slots[t & (kCapacity - 1)] = record;
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+// Hands a ring back to the log when its thread exits; queued records are still written
+struct AccessLogLease {
+  AccessLog& owner;
+  AccessLogRing* ring;
+
+  explicit AccessLogLease(AccessLog& owner) : owner(owner), ring(owner.acquire()) {}
+  ~AccessLogLease() { owner.release(ring); }
+};
+
+AccessLog::AccessLog() : fd(-1), enabled(false), running(false) {
+}
+
+AccessLog::~AccessLog() {
+  stop();
+}
+
+bool AccessLog::open(const std::string& path) {
+  if(path == "-") {
+    fd = STDOUT_FILENO;
+  }
+  else {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+      std::cerr << "Failed to open access log " << path << ": " << strerror(errno) << "\n";
+      return false;
+    }
+  }
+  running = true;
+  writer = std::thread(&AccessLog::writeLoop, this);
+  enabled = true;
+  return true;
+}
+
+void AccessLog::stop() {
+  if(!running.exchange(false)) {
+    return;
+  }
+  enabled = false;
+  wake.notify_one();
+  writer.join();
+  if(fd != STDOUT_FILENO) {
+    close(fd);
+  }
+  fd = -1;
+}
+
+AccessLogRing* AccessLog::acquire() {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  if(!freeRings.empty()) {
+    AccessLogRing* ring = freeRings.back();
+    freeRings.pop_back();
+    return ring;
+  }
+  rings.emplace_back(new AccessLogRing());
+  return rings.back().get();
+}
+
+void AccessLog::release(AccessLogRing* ring) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  freeRings.push_back(ring);
+}
+
+AccessLogRing& AccessLog::local() {
+  thread_local AccessLogLease lease(*this);
+  return *lease.ring;
+}
+
+void AccessLog::log(std::string_view method, std::string_view target, int status, uint64_t bytes, uint64_t startNanos) {
+  if(!isEnabled()) {
+    return;
+  }
+
+  AccessRecord record;
+  record.latency = monotonicNanos() - startNanos;
+  record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count() - record.latency;
+  record.bytes = bytes;
+  record.status = static_cast<uint16_t>(status);
+  record.methodLength = static_cast<uint8_t>(std::min(method.size(), sizeof(record.method)));
+  record.targetLength = static_cast<uint8_t>(std::min(target.size(), sizeof(record.target)));
+  memcpy(record.method, method.data(), record.methodLength);
+  memcpy(record.target, target.data(), record.targetLength);
+  local().push(record);
+}
+
+uint64_t AccessLog::dropped() {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  uint64_t total = 0;
+  for(const std::unique_ptr<AccessLogRing>& ring : rings) {
+    total += ring->drops();
+  }
+  return total;
+}
+
+// Append s as the inside of a JSON string
+static void appendEscaped(std::string& out, const char* s, size_t len) {
+  for(size_t i = 0; i < len; ++i) {
+    unsigned char c = s[i];
+    if(c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    }
+    else if(c < 0x20 || c == 0x7f) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    }
+    else {
+      out += c;
+    }
+  }
+}
+
+static void formatRecord(std::string& out, const AccessRecord& record) {
+  time_t seconds = record.time / 1000000000;
+  struct tm utc;
+  gmtime_r(&seconds, &utc);
+  char stamp[32];
+  size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(stamp + n, sizeof(stamp) - n, ".%06uZ", static_cast<unsigned>(record.time % 1000000000 / 1000));
+
+  out += "{\"time\":\"";
+  out += stamp;
+  out += "\",\"method\":\"";
+  appendEscaped(out, record.method, record.methodLength);
+  out += "\",\"path\":\"";
+  appendEscaped(out, record.target, record.targetLength);
+  char tail[96];
+  snprintf(tail, sizeof(tail), "\",\"status\":%u,\"bytes\":%llu,\"latency_us\":%.1f}\n",
+           record.status, static_cast<unsigned long long>(record.bytes), record.latency / 1000.0);
+  out += tail;
+}
+
+static void writeAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while(written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return;  // nowhere to report it; the lines are lost
+    }
+    written += n;
+  }
+}
+
+size_t AccessLog::drainAll(std::string& batch) {
+  // Rings are never freed, so they can be drained without holding the registry lock
+  std::vector<AccessLogRing*> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(const std::unique_ptr<AccessLogRing>& ring : rings) {
+      snapshot.push_back(ring.get());
+    }
+  }
+
+  size_t total = 0;
+  for(AccessLogRing* ring : snapshot) {
+    total += ring->drain([&](const AccessRecord& record) {
+      formatRecord(batch, record);
+      if(batch.size() >= kBatchBytes) {
+        writeAll(fd, batch);
+        batch.clear();
+      }
+    });
+  }
+  return total;
+}
+
+void AccessLog::writeLoop() {
+  std::string batch;
+  batch.reserve(kBatchBytes + 512);
+
+  while(running) {
+    drainAll(batch);
+    if(!batch.empty()) {
+      writeAll(fd, batch);
+      batch.clear();
+    }
+    // Producers never signal (that would need a lock); poll instead
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    wake.wait_for(lock, kWriterInterval, [this]() { return !running; });
+  }
+
+  drainAll(batch);
+  writeAll(fd, batch);
+}
+
+AccessLog& accessLog() {
+  static AccessLog instance;
+  return instance;
+}
@@ -0,0 +1,107 @@
+#ifndef ACCESS_LOG_HPP
+#define ACCESS_LOG_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <condition_variable>
+
+// One access log line before formatting. Fixed size, so queueing it is a copy into a ring slot.
+struct AccessRecord {
+  uint64_t time;        // wall clock, ns since the epoch, when the request head was parsed
+  uint64_t latency;     // ns from the request head being parsed to the last response byte being sent
+  uint64_t bytes;       // response bytes, headers included
+  uint16_t status;
+  uint8_t methodLength;
+  uint8_t targetLength;
+  char method[12];
+  char target[200];     // longer targets are truncated
+};
+
+// Single-producer, single-consumer queue of records. The producer is the thread that
+// owns the ring and the consumer is the writer thread, so neither side takes a lock.
+class AccessLogRing {
+  public:
+    static const size_t kCapacity = 1024;  // power of two
+
+  private:
+    AccessRecord slots[kCapacity];
+    alignas(64) std::atomic<uint64_t> head;     // next slot the writer reads
+    alignas(64) std::atomic<uint64_t> tail;     // next slot the producer fills
+    std::atomic<uint64_t> dropped;              // records lost because the ring was full
+
+  public:
+    AccessLogRing() : head(0), tail(0), dropped(0) {}
+
+    // Producer side. Returns false (and counts a drop) when the writer has fallen behind.
+    bool push(const AccessRecord& record);
+
+    // Consumer side: hand each queued record to `sink`, oldest first, and free the slots
+    template<typename Sink>
+    size_t drain(Sink sink) {
+      uint64_t first = head.load(std::memory_order_relaxed);
+      uint64_t last = tail.load(std::memory_order_acquire);
+      for(uint64_t i = first; i != last; ++i) {
+        sink(slots[i & (kCapacity - 1)]);
+      }
+      head.store(last, std::memory_order_release);
+      return last - first;
+    }
+
+    uint64_t drops() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+// Asynchronous access log. Request threads queue fixed-size records into a ring of
+// their own, and a background writer formats them as JSON lines and appends them to
+// the log file in large batched write() calls. If the writer (or the disk) falls
+// behind, records are dropped and counted rather than making request threads wait.
+class AccessLog {
+  private:
+    int fd;
+    std::atomic<bool> enabled;
+    std::atomic<bool> running;
+
+    std::mutex registryMutex;  // only taken when a thread gets or returns a ring, and by the writer
+    std::vector<std::unique_ptr<AccessLogRing>> rings;
+    std::vector<AccessLogRing*> freeRings;
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread writer;
+
+    friend struct AccessLogLease;
+    AccessLogRing* acquire();
+    void release(AccessLogRing* ring);
+
+    AccessLogRing& local();
+    void writeLoop();
+    size_t drainAll(std::string& batch);
+
+  public:
+    AccessLog();
+    ~AccessLog();
+
+    // Open path for appending ("-" = stdout) and start the writer. Returns false if it can't be opened.
+    bool open(const std::string& path);
+
+    // Write out everything queued so far and stop the writer
+    void stop();
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // Queue one line; never blocks. startNanos is the monotonicNanos() time the request was parsed.
+    void log(std::string_view method, std::string_view target, int status, uint64_t bytes, uint64_t startNanos);
+
+    // Records dropped so far because a ring was full
+    uint64_t dropped();
+};
+
+// Process-wide access log; disabled until open() is called
+AccessLog& accessLog();
+
+#endif // ACCESS_LOG_HPP
@@ -0,0 +1,124 @@
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "admission.hpp"
+#include "metrics.hpp"
+
+ClientRateTable::ClientRateTable() : shards(new Shard[kShards]), rate(0), burst(0) {
+  for(size_t i = 0; i < kShards; ++i) {
+    memset(shards[i].slots, 0, sizeof(shards[i].slots));
+  }
+}
+
+void ClientRateTable::configure(double rate, double burst) {
+  this->rate = rate;
+  this->burst = burst;
+}
+
+bool ClientRateTable::take(uint32_t address, uint64_t nowNanos) {
+  // Fibonacci hashing: the top bits pick the shard, the next ones the first slot
+  uint64_t hash = address * 0x9E3779B97F4A7C15ULL;
+  Shard& shard = shards[hash >> 58];
+  size_t first = (hash >> 40) & (kSlotsPerShard - 1);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  Slot* slot = nullptr;
+  Slot* oldest = nullptr;  // free slots have lastNanos 0, so they come first
+  for(size_t i = 0; i < kProbe; ++i) {
+    Slot& candidate = shard.slots[(first + i) & (kSlotsPerShard - 1)];
+    if(candidate.address == address) {
+      slot = &candidate;
+      break;
+    }
+    if(!oldest || candidate.lastNanos < oldest->lastNanos) {
+      oldest = &candidate;
+    }
+  }
+
+  if(!slot) {
+    // A new client, or one forgotten since: it starts with a full bucket
+    slot = oldest;
+    slot->address = address;
+    slot->tokens = static_cast<float>(burst);
+  }
+  else {
+    double refill = (nowNanos - slot->lastNanos) * 1e-9 * rate;
+    slot->tokens = static_cast<float>(std::min(burst, slot->tokens + refill));
+  }
+  slot->lastNanos = nowNanos;
+
+  if(slot->tokens < 1) {
+    return false;
+  }
+  slot->tokens -= 1;
+  return true;
+}
+
+Admission::Admission() : maxConnections(0), rateLimited(false), active(0), rejectedCapacity(0), rejectedRate(0) {}
+
+void Admission::configure(size_t maxConnections, double rate, double burst) {
+  this->maxConnections = maxConnections;
+  rateLimited = rate > 0;
+  clients.configure(rate, burst > 0 ? burst : std::max(rate, 1.0));
+}
+
+Admission::Verdict Admission::admit(uint32_t address) {
+  uint64_t open = active.fetch_add(1, std::memory_order_relaxed);
+  if(maxConnections > 0 && open >= maxConnections) {
+    release();
+    rejectedCapacity.fetch_add(1, std::memory_order_relaxed);
+    return OverCapacity;
+  }
+  if(rateLimited && !clients.take(address, monotonicNanos())) {
+    release();
+    rejectedRate.fetch_add(1, std::memory_order_relaxed);
+    return RateLimited;
+  }
+  return Admitted;
+}
+
+Admission::Stats Admission::stats() const {
+  return Stats{rejectedCapacity.load(std::memory_order_relaxed), rejectedRate.load(std::memory_order_relaxed)};
+}
+
+Admission& admission() {
+  static Admission instance;
+  return instance;
+}
+
+void rejectConnection(int client_fd, Admission::Verdict verdict) {
+  static const char overCapacity[] =
+      "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  static const char rateLimited[] =
+      "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  const char* response = verdict == Admission::RateLimited ? rateLimited : overCapacity;
+  size_t length = verdict == Admission::RateLimited ? sizeof(rateLimited) - 1 : sizeof(overCapacity) - 1;
+
+  // A new socket's buffer is empty, so this fits in one non-blocking send
+  ssize_t ignored = send(client_fd, response, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+  (void)ignored;
+
+  // The request is usually not in yet; if it is, read it so close() sends a FIN, not a reset
+  char discard[4096];
+  for(int i = 0; i < 4 && recv(client_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++i) {
+  }
+  close(client_fd);
+}
+
+bool admitConnection(int client_fd, const struct sockaddr_in* peer) {
+  struct sockaddr_in looked;
+  if(!peer && admission().needsAddress()) {
+    socklen_t length = sizeof(looked);
+    if(getpeername(client_fd, (struct sockaddr*)&looked, &length) == 0) {
+      peer = &looked;
+    }
+  }
+
+  Admission::Verdict verdict = admission().admit(peer ? peer->sin_addr.s_addr : 0);
+  if(verdict == Admission::Admitted) {
+    return true;
+  }
+  rejectConnection(client_fd, verdict);
+  return false;
+}
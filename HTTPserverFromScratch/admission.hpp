@@ -0,0 +1,103 @@
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <netinet/in.h>
+
+// Token buckets for client addresses in a fixed-size table, so a flood of new
+// addresses costs no memory or allocation. The table is split into shards, each with
+// its own lock and an open-addressed array of 16-byte slots. When a short probe finds
+// neither the address nor a free slot, the least recently seen slot in it is reused.
+// An entry idle long enough to be reused has usually refilled, so forgetting it changes
+// nothing as long as the table holds the clients that are currently active.
+class ClientRateTable {
+  public:
+    static const size_t kShards = 64;           // power of two
+    static const size_t kSlotsPerShard = 512;   // power of two; 8 KB per shard
+    static const size_t kProbe = 8;
+
+  private:
+    struct Slot {
+      uint32_t address;    // IPv4 address in network order; 0 = free
+      float tokens;
+      uint64_t lastNanos;  // when tokens was last brought up to date
+    };
+
+    struct alignas(64) Shard {
+      std::mutex mutex;
+      Slot slots[kSlotsPerShard];
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    double rate;   // tokens added per second
+    double burst;  // bucket size
+
+  public:
+    ClientRateTable();
+
+    void configure(double rate, double burst);
+
+    // Take one token from address's bucket at time now. Returns false if it is empty.
+    bool take(uint32_t address, uint64_t nowNanos);
+};
+
+// Connection admission control, checked as each connection is accepted and before any
+// thread, buffer or event loop registration is spent on it: a cap on the connections
+// open at once, and a token bucket of new connections per client address. Rejected
+// connections get a short error response (rejectConnection()) and are closed at once,
+// so overload sheds the excess early instead of slowing every admitted client down.
+class Admission {
+  public:
+    enum Verdict { Admitted, OverCapacity, RateLimited };
+
+    struct Stats {
+      uint64_t rejectedCapacity;
+      uint64_t rejectedRate;
+    };
+
+  private:
+    size_t maxConnections;  // 0 = no cap
+    bool rateLimited;
+    ClientRateTable clients;
+    alignas(64) std::atomic<uint64_t> active;
+    std::atomic<uint64_t> rejectedCapacity;
+    std::atomic<uint64_t> rejectedRate;
+
+  public:
+    Admission();
+
+    // rate is new connections per second per client address (0 = unlimited), burst the
+    // most it may open at once (0 = rate)
+    void configure(size_t maxConnections, double rate, double burst);
+
+    // Whether rate limiting is on, i.e. admit() needs the client's address
+    bool needsAddress() const { return rateLimited; }
+
+    // Decide on a new connection from address (IPv4, network order). An Admitted
+    // connection counts toward the cap until release() is called for it.
+    Verdict admit(uint32_t address);
+
+    // An admitted connection was closed
+    void release() { active.fetch_sub(1, std::memory_order_relaxed); }
+
+    Stats stats() const;
+};
+
+// Process-wide admission control used by every accept path
+Admission& admission();
+
+// Answer a connection that was not admitted (503 when over capacity, 429 when rate
+// limited), discard whatever it already sent so the close is not turned into a reset,
+// and close it. Never blocks.
+void rejectConnection(int client_fd, Admission::Verdict verdict);
+
+// Admit or reject a connection that was just accepted; rejected ones are closed.
+// peer is the address accept() filled in, if it was asked for; otherwise it is looked
+// up when rate limiting needs it. Returns true if the caller should go on serving client_fd.
+bool admitConnection(int client_fd, const struct sockaddr_in* peer = nullptr);
+
+#endif // ADMISSION_HPP
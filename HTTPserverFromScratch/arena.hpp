@@ -0,0 +1,33 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <memory_resource>
+
+// Bytes each arena can hand out before it needs memory from its upstream
+const size_t kArenaInlineBytes = 1024;
+
+// Bump allocator for everything built while answering a batch of requests on one
+// connection (response headers, small bodies, error pages). Allocation is a pointer
+// bump into an inline block, deallocation is a no-op, and reset() frees it all at
+// once. When the inline block runs out, more chunks come from `upstream`, normally
+// the owning worker's pool, so even those rarely reach the global allocator.
+class Arena {
+  private:
+    alignas(std::max_align_t) char initial[kArenaInlineBytes];
+    std::pmr::monotonic_buffer_resource resource;
+
+  public:
+    explicit Arena(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : resource(initial, sizeof(initial), upstream) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    std::pmr::memory_resource* get() { return &resource; }
+
+    // Release every allocation; nothing allocated from get() may be used afterwards
+    void reset() { resource.release(); }
+};
+
+#endif // ARENA_HPP
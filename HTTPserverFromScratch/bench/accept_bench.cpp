@@ -0,0 +1,91 @@
+// Connection-rate benchmark: every request opens a fresh TCP connection, so the
+// result is dominated by accept() throughput on the server side.
+//
+//   g++ -std=c++17 -O2 -o accept_bench bench/accept_bench.cpp -pthread
+//   ./accept_bench [port] [client_threads] [seconds] [path]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static bool oneConnection(const sockaddr_in& addr, const std::string& request) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) {
+    return false;
+  }
+
+  // Avoid piling up TIME_WAIT sockets on the client side
+  struct linger lg = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+
+  bool ok = connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 &&
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size();
+
+  // The server closes after the response, so read until EOF
+  char buffer[4096];
+  ssize_t nbytes = 0;
+  size_t total = 0;
+  while(ok && (nbytes = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    total += nbytes;
+  }
+  close(fd);
+  return ok && total > 0;
+}
+
+int main(int argc, char** argv) {
+  int port = argc > 1 ? std::atoi(argv[1]) : 4221;
+  unsigned threads = argc > 2 ? std::atoi(argv[2]) : 8;
+  int seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+  std::string path = argc > 4 ? argv[4] : "/index.html";
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned long> completed(0), failed(0);
+
+  std::vector<std::thread> clients;
+  auto start = std::chrono::steady_clock::now();
+  for(unsigned i = 0; i < threads; ++i) {
+    clients.emplace_back([&]() {
+      unsigned long ok = 0, bad = 0;
+      while(!stop.load(std::memory_order_relaxed)) {
+        if(oneConnection(addr, request)) {
+          ++ok;
+        }
+        else {
+          ++bad;
+        }
+      }
+      completed += ok;
+      failed += bad;
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for(auto& t : clients) {
+    t.join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "{\"threads\": " << threads
+            << ", \"seconds\": " << elapsed
+            << ", \"connections\": " << completed.load()
+            << ", \"failed\": " << failed.load()
+            << ", \"connections_per_sec\": " << completed.load() / elapsed << "}\n";
+  return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Measure new-connection throughput with 1..N reuseport listeners.
+#   bench/accept_scaling.sh [max_listeners] [client_threads] [seconds]
+# Run from the project root after building ./server and ./accept_bench.
+MAX=${1:-$(nproc)}
+CLIENTS=${2:-16}
+SECONDS_PER_RUN=${3:-5}
+PORT=4321
+
+echo "index" > index.html 2>/dev/null || true
+
+n=1
+while [ "$n" -le "$MAX" ]; do
+    ./server --port $PORT --listeners "$n" --pin-cpus >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    printf '{"listeners": %s, "result": ' "$n"
+    ./accept_bench $PORT "$CLIENTS" "$SECONDS_PER_RUN" /index.html | tr -d '\n'
+    echo "}"
+    kill "$pid"
+    wait "$pid" 2>/dev/null
+    n=$((n + 1))
+done
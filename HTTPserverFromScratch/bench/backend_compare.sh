@@ -0,0 +1,25 @@
+#!/bin/sh
+# Compare the I/O backends on keep-alive and new-connection workloads.
+#   bench/backend_compare.sh [workers] [connections] [seconds]
+# Run from the project root after building ./server, ./request_bench and ./accept_bench.
+WORKERS=${1:-$(nproc)}
+CONNECTIONS=${2:-64}
+SECONDS_PER_RUN=${3:-5}
+PORT=4322
+
+echo "index" > index.html 2>/dev/null || true
+
+for io in threads epoll uring; do
+    ./server --io "$io" --workers "$WORKERS" --port $PORT >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    printf '{"io": "%s", "keepalive": ' "$io"
+    ./request_bench $PORT "$CONNECTIONS" "$SECONDS_PER_RUN" /index.html 1 | tr -d '\n'
+    printf ', "pipelined": '
+    ./request_bench $PORT "$CONNECTIONS" "$SECONDS_PER_RUN" /index.html 16 | tr -d '\n'
+    printf ', "new_connections": '
+    ./accept_bench $PORT 16 "$SECONDS_PER_RUN" /index.html | tr -d '\n'
+    echo "}"
+    kill "$pid"
+    wait "$pid" 2>/dev/null
+done
@@ -0,0 +1,667 @@
+// Load generator for the server. Client threads each drive a share of the
+// connections from their own epoll loop over loopback (or any IPv4 host).
+//
+// Closed loop (default): every connection keeps --pipeline requests in flight and
+// sends the next one as soon as a response arrives, so it measures how many
+// requests per second the server sustains.
+//
+// Open loop (--rate N): requests are scheduled at a fixed N per second whether or
+// not the server keeps up. Latency is measured from the scheduled send time, so a
+// server that stalls is charged for the requests that queued up behind the stall.
+//
+// Keep-alive connections are reused by default; --new-connections opens a fresh
+// connection for every request (latency then includes the TCP handshake).
+//
+// The request mix is a weighted list of GETs and POSTs:
+//   --get /index.html:8 --get /big.bin:1 --post 4096:1
+//
+// One JSON line per run goes to stdout; --label tags it (e.g. with a commit id) so
+// runs against different server versions can be compared.
+//
+//   g++ -std=c++17 -O2 -o load_gen bench/load_gen.cpp -pthread
+//   ./load_gen --connections 64 --threads 4 --duration 10 --pipeline 4
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct RequestKind {
+  std::string name;     // "GET /path" or "POST 4096"
+  std::string bytes;    // the complete request
+  unsigned weight;
+};
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 4221;
+  unsigned threads = 1;
+  unsigned connections = 8;
+  double duration = 5;
+  double warmup = 1;
+  unsigned pipeline = 1;
+  double rate = 0;              // requests per second across all threads; 0 = closed loop
+  bool newConnections = false;
+  std::string postPath = "/load_gen.bin";
+  std::string label;
+  std::vector<std::string> gets;   // PATH[:weight]
+  std::vector<std::string> posts;  // SIZE[:weight]
+};
+
+// Log-linear histogram of nanoseconds: 16 sub-buckets per power of two (about 6% precision)
+class Histogram {
+  private:
+    static const int kSubBits = 4;
+    static const int kMaxMagnitude = 36;
+    static const int kBuckets = (kMaxMagnitude + 2) << kSubBits;
+    std::vector<uint64_t> buckets;
+
+    static int index(uint64_t v) {
+      int msb = v == 0 ? 0 : 63 - __builtin_clzll(v);
+      int magnitude = msb > kSubBits ? msb - kSubBits : 0;
+      if(magnitude > kMaxMagnitude) {
+        return kBuckets - 1;
+      }
+      return (magnitude << kSubBits) + static_cast<int>(v >> magnitude);
+    }
+
+    static uint64_t start(int i) {
+      if(i < (2 << kSubBits)) {
+        return i;
+      }
+      int magnitude = (i >> kSubBits) - 1;
+      return static_cast<uint64_t>(i - (magnitude << kSubBits)) << magnitude;
+    }
+
+  public:
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    Histogram() : buckets(kBuckets, 0) {}
+
+    void record(uint64_t v) {
+      ++buckets[index(v)];
+      ++count;
+      sum += v;
+      max = std::max(max, v);
+    }
+
+    void merge(const Histogram& other) {
+      for(int i = 0; i < kBuckets; ++i) {
+        buckets[i] += other.buckets[i];
+      }
+      count += other.count;
+      sum += other.sum;
+      max = std::max(max, other.max);
+    }
+
+    // Upper end of the bucket holding the q-th quantile
+    uint64_t quantile(double q) const {
+      uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+      uint64_t seen = 0;
+      for(int i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if(seen >= rank && seen > 0) {
+          return std::min(start(i + 1), max);
+        }
+      }
+      return max;
+    }
+};
+
+struct Stats {
+  Histogram latency;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  uint64_t bytes = 0;
+  uint64_t status[6] = {};
+
+  void merge(const Stats& other) {
+    latency.merge(other.latency);
+    requests += other.requests;
+    errors += other.errors;
+    bytes += other.bytes;
+    for(int i = 0; i < 6; ++i) {
+      status[i] += other.status[i];
+    }
+  }
+};
+
+struct Connection {
+  int fd = -1;
+  bool connected = false;
+  bool closeAfterResponse = false;  // the server said Connection: close
+  std::string out;
+  size_t outOffset = 0;
+  std::string in;
+  std::deque<uint64_t> inFlight;    // start time of each request awaiting a response
+  uint64_t retryAt = 0;
+  bool wantWrite = false;
+};
+
+class Worker {
+  private:
+    const Options& options;
+    const std::vector<RequestKind>& mix;
+    unsigned totalWeight;
+    sockaddr_in addr;
+    int epollFd;
+    std::vector<Connection> conns;
+    uint64_t measureStart, measureEnd;
+    uint64_t rng;
+
+    double rate;                   // this worker's share, requests per second
+    uint64_t nextSend = 0;         // open loop: scheduled time of the next request
+    std::deque<uint64_t> backlog;  // open loop: scheduled requests not yet sent
+    size_t cursor = 0;
+
+  public:
+    Stats stats;
+
+    Worker(const Options& options, const std::vector<RequestKind>& mix, const sockaddr_in& addr,
+           unsigned connections, double rate, uint64_t measureStart, uint64_t measureEnd, uint64_t seed)
+        : options(options), mix(mix), addr(addr), conns(connections), measureStart(measureStart),
+          measureEnd(measureEnd), rng(seed | 1), rate(rate) {
+      totalWeight = 0;
+      for(const RequestKind& kind : mix) {
+        totalWeight += kind.weight;
+      }
+      epollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~Worker() {
+      for(Connection& conn : conns) {
+        if(conn.fd >= 0) {
+          close(conn.fd);
+        }
+      }
+      close(epollFd);
+    }
+
+    void run();
+
+  private:
+    const RequestKind& pick() {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      unsigned r = rng % totalWeight;
+      for(const RequestKind& kind : mix) {
+        if(r < kind.weight) {
+          return kind;
+        }
+        r -= kind.weight;
+      }
+      return mix.back();
+    }
+
+    bool canIssue(const Connection& conn, uint64_t now) const {
+      if(now < conn.retryAt || conn.closeAfterResponse) {
+        return false;
+      }
+      unsigned depth = options.newConnections ? 1 : options.pipeline;
+      return conn.inFlight.size() < depth;
+    }
+
+    bool open(Connection& conn);
+    void fail(Connection& conn, uint64_t now);
+    void finish(Connection& conn);
+    void issue(Connection& conn, uint64_t start);
+    void updateInterest(Connection& conn);
+    bool flush(Connection& conn);
+    bool onReadable(Connection& conn, uint64_t now);
+    void dispatch(uint64_t now);
+};
+
+bool Worker::open(Connection& conn) {
+  conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  conn.connected = false;
+  conn.closeAfterResponse = false;
+  conn.out.clear();
+  conn.outOffset = 0;
+  conn.in.clear();
+  if(connect(conn.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 && errno != EINPROGRESS) {
+    close(conn.fd);
+    conn.fd = -1;
+    return false;
+  }
+  struct epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLOUT;  // EPOLLOUT reports the end of the handshake
+  ev.data.ptr = &conn;
+  conn.wantWrite = true;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &ev);
+  return true;
+}
+
+// Drop the connection, count what was in flight as failed and retry a little later
+void Worker::fail(Connection& conn, uint64_t now) {
+  if(now >= measureStart) {
+    stats.errors += conn.inFlight.size();
+  }
+  conn.inFlight.clear();
+  finish(conn);
+  conn.retryAt = now + 10 * 1000 * 1000;
+}
+
+void Worker::finish(Connection& conn) {
+  if(conn.fd >= 0) {
+    close(conn.fd);  // also removes it from the epoll set
+    conn.fd = -1;
+  }
+  conn.connected = false;
+  conn.closeAfterResponse = false;
+}
+
+void Worker::issue(Connection& conn, uint64_t start) {
+  if(conn.fd < 0 && !open(conn)) {
+    if(start >= measureStart) {
+      ++stats.errors;
+    }
+    conn.retryAt = nowNanos() + 10 * 1000 * 1000;
+    return;
+  }
+  const RequestKind& kind = pick();
+  if(conn.outOffset == conn.out.size()) {
+    conn.out.clear();
+    conn.outOffset = 0;
+  }
+  conn.out += kind.bytes;
+  conn.inFlight.push_back(start);
+  if(conn.connected && !flush(conn)) {
+    fail(conn, nowNanos());
+  }
+}
+
+void Worker::updateInterest(Connection& conn) {
+  bool want = conn.outOffset < conn.out.size() || !conn.connected;
+  if(want == conn.wantWrite) {
+    return;
+  }
+  struct epoll_event ev{};
+  ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  ev.data.ptr = &conn;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+  conn.wantWrite = want;
+}
+
+bool Worker::flush(Connection& conn) {
+  while(conn.outOffset < conn.out.size()) {
+    ssize_t n = send(conn.fd, conn.out.data() + conn.outOffset, conn.out.size() - conn.outOffset, MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    conn.outOffset += n;
+  }
+  updateInterest(conn);
+  return true;
+}
+
+// Read and account for every complete response. Returns false if the connection broke.
+bool Worker::onReadable(Connection& conn, uint64_t now) {
+  char chunk[65536];
+  bool peerClosed = false;
+  while(true) {
+    ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+    if(n > 0) {
+      conn.in.append(chunk, n);
+      continue;
+    }
+    if(n == 0) {
+      peerClosed = true;
+    }
+    else if(errno == EINTR) {
+      continue;
+    }
+    else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    break;
+  }
+
+  size_t consumed = 0;
+  while(!conn.inFlight.empty()) {
+    size_t headEnd = conn.in.find("\r\n\r\n", consumed);
+    if(headEnd == std::string::npos) {
+      break;
+    }
+    std::string_view head(conn.in.data() + consumed, headEnd - consumed);
+    size_t length = 0;
+    size_t cl = head.find("Content-Length: ");
+    if(cl != std::string_view::npos) {
+      length = std::strtoul(head.data() + cl + 16, nullptr, 10);
+    }
+    size_t total = headEnd + 4 - consumed + length;
+    if(conn.in.size() - consumed < total) {
+      break;
+    }
+
+    int statusClass = head.size() > 9 && head[9] >= '1' && head[9] <= '5' ? head[9] - '0' : 0;
+    uint64_t start = conn.inFlight.front();
+    conn.inFlight.pop_front();
+    if(statusClass != 1) {  // a 100 Continue is not the final response
+      if(now >= measureStart && now <= measureEnd) {
+        ++stats.requests;
+        ++stats.status[statusClass];
+        stats.bytes += total;
+        stats.latency.record(now - start);
+      }
+    }
+    else {
+      conn.inFlight.push_front(start);
+    }
+    if(head.find("Connection: close") != std::string_view::npos) {
+      conn.closeAfterResponse = true;
+    }
+    consumed += total;
+  }
+  conn.in.erase(0, consumed);
+
+  if(options.newConnections && conn.inFlight.empty() && conn.outOffset == conn.out.size()) {
+    finish(conn);
+    return true;
+  }
+  if(conn.closeAfterResponse && conn.inFlight.empty()) {
+    finish(conn);
+    return true;
+  }
+  return !peerClosed;
+}
+
+// Hand out work to every connection that has room for another request
+void Worker::dispatch(uint64_t now) {
+  if(rate <= 0) {
+    for(Connection& conn : conns) {
+      while(canIssue(conn, now)) {
+        issue(conn, now);
+        if(conn.fd < 0) {
+          break;
+        }
+      }
+    }
+    return;
+  }
+
+  uint64_t interval = static_cast<uint64_t>(1e9 / rate);
+  while(nextSend <= now) {
+    backlog.push_back(nextSend);
+    nextSend += interval;
+  }
+  for(size_t scanned = 0; !backlog.empty() && scanned < conns.size(); ++scanned) {
+    Connection& conn = conns[cursor];
+    cursor = (cursor + 1) % conns.size();
+    while(!backlog.empty() && canIssue(conn, now)) {
+      issue(conn, backlog.front());
+      backlog.pop_front();
+      if(conn.fd < 0) {
+        break;
+      }
+    }
+  }
+}
+
+void Worker::run() {
+  uint64_t now = nowNanos();
+  nextSend = now;
+  if(!options.newConnections) {
+    for(Connection& conn : conns) {
+      open(conn);
+    }
+  }
+
+  struct epoll_event events[256];
+  uint64_t nextScan = now;
+  while(now < measureEnd) {
+    if(rate > 0 || now >= nextScan) {
+      dispatch(now);
+      nextScan = now + 10 * 1000 * 1000;  // closed loop refills after each response; this only retries
+    }
+
+    int timeout = 10;
+    if(rate > 0) {
+      timeout = nextSend > now ? static_cast<int>((nextSend - now) / 1000000) : 0;
+    }
+    int n = epoll_wait(epollFd, events, 256, std::min(timeout, 10));
+    now = nowNanos();
+    for(int i = 0; i < n; ++i) {
+      Connection& conn = *static_cast<Connection*>(events[i].data.ptr);
+      if(conn.fd < 0) {
+        continue;
+      }
+      if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+        if(!(events[i].events & EPOLLIN) || !onReadable(conn, now)) {
+          fail(conn, now);
+          continue;
+        }
+      }
+      if(!conn.connected && (events[i].events & EPOLLOUT)) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if(error != 0) {
+          fail(conn, now);
+          continue;
+        }
+        conn.connected = true;
+      }
+      if((events[i].events & EPOLLIN) && conn.fd >= 0 && !onReadable(conn, now)) {
+        fail(conn, now);
+        continue;
+      }
+      if(conn.fd >= 0 && !flush(conn)) {
+        fail(conn, now);
+        continue;
+      }
+      // Closed loop: top the connection up straight away
+      if(rate <= 0) {
+        while(canIssue(conn, now) && (conn.fd >= 0 || options.newConnections)) {
+          issue(conn, now);
+          if(conn.fd < 0) {
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void printUsage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [options]\n"
+            << "  --host ADDR          server IPv4 address (default 127.0.0.1)\n"
+            << "  --port N             server port (default 4221)\n"
+            << "  --threads N          client threads (default 1)\n"
+            << "  --connections N      connections across all threads (default 8)\n"
+            << "  --duration S         measured seconds (default 5)\n"
+            << "  --warmup S           seconds run before measuring (default 1)\n"
+            << "  --pipeline N         requests in flight per keep-alive connection (default 1)\n"
+            << "  --rate N             open loop at N requests/s; 0 = closed loop (default 0)\n"
+            << "  --new-connections    one connection per request instead of keep-alive\n"
+            << "  --get PATH[:W]       add a GET to the mix with weight W (default /index.html)\n"
+            << "  --post SIZE[:W]      add a POST of SIZE bytes to the mix with weight W\n"
+            << "  --post-path PATH     target of the POSTs (default /load_gen.bin)\n"
+            << "  --label TEXT         copied into the output, e.g. the server version\n";
+}
+
+static bool parseArgs(int argc, char** argv, Options& options) {
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if(arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      return false;
+    }
+    if(arg == "--new-connections") {
+      options.newConnections = true;
+      continue;
+    }
+    if(i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return false;
+    }
+    std::string value = argv[++i];
+    if(arg == "--host") options.host = value;
+    else if(arg == "--port") options.port = std::atoi(value.c_str());
+    else if(arg == "--threads") options.threads = std::max(1, std::atoi(value.c_str()));
+    else if(arg == "--connections") options.connections = std::max(1, std::atoi(value.c_str()));
+    else if(arg == "--duration") options.duration = std::atof(value.c_str());
+    else if(arg == "--warmup") options.warmup = std::atof(value.c_str());
+    else if(arg == "--pipeline") options.pipeline = std::max(1, std::atoi(value.c_str()));
+    else if(arg == "--rate") options.rate = std::atof(value.c_str());
+    else if(arg == "--get") options.gets.push_back(value);
+    else if(arg == "--post") options.posts.push_back(value);
+    else if(arg == "--post-path") options.postPath = value;
+    else if(arg == "--label") options.label = value;
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      printUsage(argv[0]);
+      return false;
+    }
+  }
+  options.threads = std::min(options.threads, options.connections);
+  return true;
+}
+
+// Split "VALUE[:WEIGHT]"
+static std::string splitWeight(const std::string& spec, unsigned& weight) {
+  size_t colon = spec.rfind(':');
+  weight = 1;
+  if(colon == std::string::npos || colon == 0) {
+    return spec;
+  }
+  weight = std::max(1, std::atoi(spec.c_str() + colon + 1));
+  return spec.substr(0, colon);
+}
+
+static std::vector<RequestKind> buildMix(const Options& options) {
+  std::string connection = options.newConnections ? "Connection: close\r\n" : "";
+  std::vector<RequestKind> mix;
+  for(const std::string& spec : options.gets) {
+    RequestKind kind;
+    std::string path = splitWeight(spec, kind.weight);
+    kind.name = "GET " + path;
+    kind.bytes = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + connection + "\r\n";
+    mix.push_back(kind);
+  }
+  for(const std::string& spec : options.posts) {
+    RequestKind kind;
+    size_t size = std::strtoul(splitWeight(spec, kind.weight).c_str(), nullptr, 10);
+    kind.name = "POST " + std::to_string(size);
+    kind.bytes = "POST " + options.postPath + " HTTP/1.1\r\nHost: localhost\r\n" + connection +
+                 "Content-Length: " + std::to_string(size) + "\r\n\r\n" + std::string(size, 'x');
+    mix.push_back(kind);
+  }
+  if(mix.empty()) {
+    mix.push_back({"GET /index.html", "GET /index.html HTTP/1.1\r\nHost: localhost\r\n" + connection + "\r\n", 1});
+  }
+  return mix;
+}
+
+static std::string jsonEscape(const std::string& s) {
+  std::string out;
+  for(char c : s) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if(!parseArgs(argc, argv, options)) {
+    return 1;
+  }
+  std::vector<RequestKind> mix = buildMix(options);
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  if(inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+    std::cerr << "Invalid host " << options.host << "\n";
+    return 1;
+  }
+
+  uint64_t begin = nowNanos();
+  uint64_t measureStart = begin + static_cast<uint64_t>(options.warmup * 1e9);
+  uint64_t measureEnd = measureStart + static_cast<uint64_t>(options.duration * 1e9);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for(unsigned i = 0; i < options.threads; ++i) {
+    unsigned share = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+    workers.emplace_back(new Worker(options, mix, addr, share, options.rate / options.threads,
+                                    measureStart, measureEnd, begin + i * 0x9e3779b97f4a7c15ULL));
+  }
+  std::vector<std::thread> threads;
+  for(auto& worker : workers) {
+    threads.emplace_back(&Worker::run, worker.get());
+  }
+  for(auto& t : threads) {
+    t.join();
+  }
+
+  Stats total;
+  for(auto& worker : workers) {
+    total.merge(worker->stats);
+  }
+
+  double seconds = options.duration;
+  std::ostringstream mixJson;
+  for(size_t i = 0; i < mix.size(); ++i) {
+    mixJson << (i ? ", " : "") << "{\"request\": \"" << jsonEscape(mix[i].name) << "\", \"weight\": " << mix[i].weight << "}";
+  }
+
+  std::cout << "{\"label\": \"" << jsonEscape(options.label) << "\""
+            << ", \"mode\": \"" << (options.rate > 0 ? "open" : "closed") << "\""
+            << ", \"keep_alive\": " << (options.newConnections ? "false" : "true")
+            << ", \"threads\": " << options.threads
+            << ", \"connections\": " << options.connections
+            << ", \"pipeline\": " << (options.newConnections ? 1 : options.pipeline)
+            << ", \"target_rate\": " << options.rate
+            << ", \"seconds\": " << seconds
+            << ", \"mix\": [" << mixJson.str() << "]"
+            << ", \"requests\": " << total.requests
+            << ", \"errors\": " << total.errors
+            << ", \"requests_per_sec\": " << total.requests / seconds
+            << ", \"bytes_per_sec\": " << total.bytes / seconds
+            << ", \"status\": {\"1xx\": " << total.status[1] << ", \"2xx\": " << total.status[2]
+            << ", \"3xx\": " << total.status[3] << ", \"4xx\": " << total.status[4]
+            << ", \"5xx\": " << total.status[5] << ", \"other\": " << total.status[0] << "}"
+            << ", \"latency_us\": {\"mean\": " << (total.latency.count ? total.latency.sum / 1000.0 / total.latency.count : 0)
+            << ", \"p50\": " << total.latency.quantile(0.5) / 1000.0
+            << ", \"p90\": " << total.latency.quantile(0.9) / 1000.0
+            << ", \"p99\": " << total.latency.quantile(0.99) / 1000.0
+            << ", \"p999\": " << total.latency.quantile(0.999) / 1000.0
+            << ", \"max\": " << total.latency.max / 1000.0 << "}}\n";
+  return total.requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+// Per-request parse cost: the old stringstream/getline parser versus HttpParser.
+//
+//   g++ -std=c++17 -O2 -o parser_bench bench/parser_bench.cpp http_parser.cpp
+//   ./parser_bench [iterations]
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "../http_parser.hpp"
+
+static const std::string kRequest =
+    "GET /static/app.js HTTP/1.1\r\n"
+    "Host: localhost:4221\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://localhost:4221/index.html\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+// The parser this project used before HttpParser: split the head into lines,
+// then re-read the request line with an istringstream.
+static std::vector<std::string> parseRequestHeaders(const std::string& request) {
+  std::stringstream ss(request);
+  std::string line;
+  std::vector<std::string> headers;
+
+  while(std::getline(ss, line) && line != "\r") {
+    headers.push_back(line);
+  }
+
+  return headers;
+}
+
+static size_t legacyParse(const std::string& request) {
+  auto headers = parseRequestHeaders(request);
+  std::istringstream requestLine(headers[0]);
+  std::string method, resource;
+  requestLine >> method >> resource;
+  return method.size() + resource.size() + headers.size();
+}
+
+static size_t parserParse(const std::string& request) {
+  HttpParser parser;
+  HttpRequest parsed;
+  parser.parse(request.data(), request.size(), parsed);
+  return parsed.method.size() + parsed.target.size() + parsed.headerCount;
+}
+
+// Same request delivered in 16-byte fragments, resuming after each one
+static size_t fragmentedParse(const std::string& request) {
+  HttpParser parser;
+  HttpRequest parsed;
+  for(size_t len = 16; len < request.size(); len += 16) {
+    parser.parse(request.data(), len, parsed);
+  }
+  parser.parse(request.data(), request.size(), parsed);
+  return parsed.method.size() + parsed.target.size() + parsed.headerCount;
+}
+
+template <typename F>
+static double nsPerRequest(F parse, long iterations) {
+  volatile size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(long i = 0; i < iterations; ++i) {
+    sink = sink + parse(kRequest);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? std::atol(argv[1]) : 1000000;
+
+  double legacy = nsPerRequest(legacyParse, iterations);
+  double incremental = nsPerRequest(parserParse, iterations);
+  double fragmented = nsPerRequest(fragmentedParse, iterations);
+
+  std::cout << "{\"iterations\": " << iterations
+            << ", \"request_bytes\": " << kRequest.size()
+            << ", \"stringstream_ns\": " << legacy
+            << ", \"http_parser_ns\": " << incremental
+            << ", \"http_parser_fragmented_ns\": " << fragmented
+            << ", \"speedup\": " << legacy / incremental << "}\n";
+  return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Fixed load_gen suite for comparing server versions. Prints one JSON line per
+# scenario, tagged with a label (default: the current git commit).
+#   bench/regression.sh [label] [seconds] [threads] >> bench-results.jsonl
+# Run from the project root after building ./server and ./load_gen.
+LABEL=${1:-$(git describe --always --dirty 2>/dev/null || echo unknown)}
+SECONDS_PER_RUN=${2:-5}
+THREADS=${3:-2}
+PORT=4323
+ROOT=$(pwd)
+DOCROOT=$(mktemp -d)
+
+# Fixed content so runs are comparable: a small page and a 1 MB file
+head -c 1024 /dev/zero | tr '\0' 'a' > "$DOCROOT/small.html"
+head -c 1048576 /dev/zero > "$DOCROOT/large.bin"
+
+(cd "$DOCROOT" && exec "$ROOT/server" --port $PORT --upload-dir "$DOCROOT/uploads") >/dev/null 2>&1 &
+pid=$!
+sleep 0.5
+
+run() {
+    ./load_gen --port $PORT --threads "$THREADS" --duration "$SECONDS_PER_RUN" --label "$LABEL" "$@"
+}
+
+run --connections 64 --get /small.html
+run --connections 64 --get /small.html --pipeline 16
+run --connections 16 --get /small.html --new-connections
+run --connections 64 --get /small.html:8 --get /large.bin:1 --post 16384:1
+run --connections 64 --get /small.html --rate 10000
+
+kill "$pid"
+wait "$pid" 2>/dev/null
+rm -rf "$DOCROOT"
@@ -0,0 +1,110 @@
+// Keep-alive request-rate benchmark: every client thread holds one persistent
+// connection and sends GETs back to back (optionally several pipelined at once),
+// so the result reflects per-request cost in the server's I/O path.
+//
+//   g++ -std=c++17 -O2 -o request_bench bench/request_bench.cpp -pthread
+//   ./request_bench [port] [connections] [seconds] [path] [pipeline_depth]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Read exactly `count` responses, using Content-Length to find where each ends
+static bool readResponses(int fd, std::string& buffer, int count) {
+  char chunk[65536];
+  while(count > 0) {
+    size_t headerEnd = buffer.find("\r\n\r\n");
+    if(headerEnd != std::string::npos) {
+      size_t length = 0;
+      size_t cl = buffer.find("Content-Length: ");
+      if(cl != std::string::npos && cl < headerEnd) {
+        length = std::strtoul(buffer.c_str() + cl + 16, nullptr, 10);
+      }
+      if(buffer.size() >= headerEnd + 4 + length) {
+        buffer.erase(0, headerEnd + 4 + length);
+        --count;
+        continue;
+      }
+    }
+    ssize_t nbytes = recv(fd, chunk, sizeof(chunk), 0);
+    if(nbytes <= 0) {
+      return false;
+    }
+    buffer.append(chunk, nbytes);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int port = argc > 1 ? std::atoi(argv[1]) : 4221;
+  unsigned connections = argc > 2 ? std::atoi(argv[2]) : 8;
+  int seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+  std::string path = argc > 4 ? argv[4] : "/index.html";
+  int depth = argc > 5 ? std::atoi(argv[5]) : 1;
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+  std::string request;
+  for(int i = 0; i < depth; ++i) {
+    request += "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  }
+
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned long> completed(0), failed(0);
+  std::vector<std::thread> clients;
+  auto start = std::chrono::steady_clock::now();
+
+  for(unsigned i = 0; i < connections; ++i) {
+    clients.emplace_back([&]() {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if(connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        ++failed;
+        close(fd);
+        return;
+      }
+
+      std::string buffer;
+      unsigned long done = 0;
+      while(!stop.load(std::memory_order_relaxed)) {
+        if(send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size() ||
+           !readResponses(fd, buffer, depth)) {
+          ++failed;
+          break;
+        }
+        done += depth;
+      }
+      completed += done;
+      close(fd);
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for(auto& t : clients) {
+    t.join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "{\"connections\": " << connections
+            << ", \"pipeline\": " << depth
+            << ", \"seconds\": " << elapsed
+            << ", \"requests\": " << completed.load()
+            << ", \"failed\": " << failed.load()
+            << ", \"requests_per_sec\": " << completed.load() / elapsed << "}\n";
+  return 0;
+}
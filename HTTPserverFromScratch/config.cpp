@@ -0,0 +1,153 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include "config.hpp"
+
+static void printUsage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [options]\n"
+            << "  --port N          port to listen on (default 4221)\n"
+            << "  --io MODE         epoll | uring | threads (default epoll)\n"
+            << "  --workers N       event loop / io_uring worker threads, 0 = one per CPU (default 0)\n"
+            << "  --backlog N       listen() backlog (default 511)\n"
+            << "  --listeners N     SO_REUSEPORT listeners with one event loop each, 0 = off (default 0)\n"
+            << "  --pin-cpus        pin each reuseport listener or io_uring worker to its own CPU\n"
+            << "  --idle-timeout S  close keep-alive connections idle for S seconds, 0 = never (default 5)\n"
+            << "  --drain-timeout S seconds to finish open connections on SIGTERM/SIGINT/SIGHUP (default 30)\n"
+            << "  --cache-bytes N   response cache budget in bytes, 0 = off (default 67108864)\n"
+            << "  --cache-max-entry N  largest file kept in the response cache (default 262144)\n"
+            << "  --gzip-level N    gzip level 1-9 for text files, 0 = off (default 6)\n"
+            << "  --gzip-cache-bytes N  budget of the compressed variant cache (default 16777216)\n"
+            << "  --gzip-max-file N largest file compressed on the fly (default 1048576)\n"
+            << "  --upload-dir DIR  directory for POST uploads (default uploads)\n"
+            << "  --max-upload N    largest POST body in bytes (default 1073741824)\n"
+            << "  --max-connections N  connections open at once before new ones get 503, 0 = no cap (default 10000)\n"
+            << "  --client-rate R   new connections per second per client address before 429, 0 = off (default 0)\n"
+            << "  --client-burst N  connections a client may open at once under --client-rate, 0 = rate (default 0)\n"
+            << "  --max-output N    queued response bytes per connection before reading pauses (default 1048576)\n"
+            << "  --access-log FILE append an access log line per request to FILE, - = stdout (default off)\n";
+}
+
+bool parseArgs(int argc, char** argv, ServerConfig& config) {
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if(arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      return false;
+    }
+    if(arg == "--pin-cpus") {
+      config.pinCpus = true;
+      continue;
+    }
+    if(i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      printUsage(argv[0]);
+      return false;
+    }
+
+    std::string value = argv[++i];
+    if(arg == "--port") {
+      config.port = std::atoi(value.c_str());
+    }
+    else if(arg == "--io") {
+      config.io = value;
+    }
+    else if(arg == "--workers") {
+      config.workers = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    else if(arg == "--backlog") {
+      config.backlog = std::atoi(value.c_str());
+    }
+    else if(arg == "--idle-timeout") {
+      config.idleTimeout = std::atoi(value.c_str());
+    }
+    else if(arg == "--drain-timeout") {
+      config.drainTimeout = std::atoi(value.c_str());
+    }
+    else if(arg == "--cache-bytes") {
+      config.cacheBytes = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--cache-max-entry") {
+      config.cacheMaxEntry = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--gzip-level") {
+      config.gzipLevel = std::atoi(value.c_str());
+    }
+    else if(arg == "--gzip-cache-bytes") {
+      config.gzipCacheBytes = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--gzip-max-file") {
+      config.gzipMaxFile = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--upload-dir") {
+      config.uploadDir = value;
+    }
+    else if(arg == "--max-upload") {
+      config.maxUpload = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--max-output") {
+      config.maxOutput = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--max-connections") {
+      config.maxConnections = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    else if(arg == "--client-rate") {
+      config.clientRate = std::strtod(value.c_str(), nullptr);
+    }
+    else if(arg == "--client-burst") {
+      config.clientBurst = std::strtod(value.c_str(), nullptr);
+    }
+    else if(arg == "--access-log") {
+      config.accessLog = value;
+    }
+    else if(arg == "--listeners") {
+      config.listeners = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      printUsage(argv[0]);
+      return false;
+    }
+  }
+
+  if(config.io != "epoll" && config.io != "uring" && config.io != "threads") {
+    std::cerr << "Unknown I/O mode " << config.io << "\n";
+    return false;
+  }
+  if(config.port <= 0 || config.port > 65535) {
+    std::cerr << "Invalid port " << config.port << "\n";
+    return false;
+  }
+  if(config.backlog <= 0) {
+    std::cerr << "Invalid backlog " << config.backlog << "\n";
+    return false;
+  }
+  if(config.drainTimeout < 0) {
+    std::cerr << "Invalid drain timeout " << config.drainTimeout << "\n";
+    return false;
+  }
+  if(config.gzipLevel < 0 || config.gzipLevel > 9) {
+    std::cerr << "Invalid gzip level " << config.gzipLevel << "\n";
+    return false;
+  }
+  if(config.maxOutput == 0) {
+    std::cerr << "Invalid output limit " << config.maxOutput << "\n";
+    return false;
+  }
+  if(config.clientRate < 0 || config.clientBurst < 0) {
+    std::cerr << "Invalid client rate limit " << config.clientRate << "/" << config.clientBurst << "\n";
+    return false;
+  }
+  if(config.listeners > 0 && config.io != "epoll") {
+    std::cerr << "--listeners requires --io epoll\n";
+    return false;
+  }
+  if(config.workers == 0) {
+    config.workers = std::thread::hardware_concurrency();
+    if(config.workers == 0) {
+      config.workers = 1;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,64 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+
+// Runtime options for the server, filled in from the command line
+struct ServerConfig {
+  int port = 4221;
+
+  // I/O model: "epoll" (event loop + fixed worker pool), "uring" (io_uring loop per worker)
+  // or "threads" (one thread per connection)
+  std::string io = "epoll";
+
+  // Number of event loop worker threads (0 = one per CPU)
+  unsigned workers = 0;
+
+  // Length of the kernel's pending-connection queue passed to listen()
+  int backlog = 511;
+
+  // When > 0, run this many SO_REUSEPORT listeners, each with its own socket and event loop
+  unsigned listeners = 0;
+
+  // Pin each reuseport listener (or io_uring worker) thread to its own CPU
+  bool pinCpus = false;
+
+  // Byte budget of the in-memory response cache (0 = disabled) and its largest cacheable file
+  size_t cacheBytes = 64 * 1024 * 1024;
+  size_t cacheMaxEntry = 256 * 1024;
+
+  // gzip level for compressible files (0 = never compress), the budget of the compressed
+  // variant cache and the largest file compressed on the fly
+  int gzipLevel = 6;
+  size_t gzipCacheBytes = 16 * 1024 * 1024;
+  size_t gzipMaxFile = 1024 * 1024;
+
+  // Directory POST uploads are stored in, and the largest body accepted
+  std::string uploadDir = "uploads";
+  size_t maxUpload = 1024UL * 1024 * 1024;
+
+  // File the access log is appended to ("-" = stdout, empty = no access log)
+  std::string accessLog;
+
+  // In-memory response bytes a connection may have queued before its further requests are
+  // held back (and, on the event loops, its socket is no longer read) until they are sent
+  size_t maxOutput = 1024 * 1024;
+
+  // Admission control: most connections open at once (0 = no cap), and new connections
+  // per second a client address may open (0 = unlimited) with a burst allowance (0 = one
+  // second's worth). Connections over either limit are answered and closed at once.
+  size_t maxConnections = 10000;
+  double clientRate = 0;
+  double clientBurst = 0;
+
+  // Seconds a keep-alive connection may sit idle before it is closed (0 = never)
+  int idleTimeout = 5;
+
+  // Seconds a graceful shutdown or restart waits for open connections before closing them
+  int drainTimeout = 30;
+};
+
+// Parse command line arguments into config. Returns false (after printing usage) on bad input.
+bool parseArgs(int argc, char** argv, ServerConfig& config);
+
+#endif // CONFIG_HPP
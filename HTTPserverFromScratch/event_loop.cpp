@@ -0,0 +1,512 @@
+#include <iostream>
+#include <thread>
+#include <memory>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <sched.h>
+#include "event_loop.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+#include "lifecycle.hpp"
+#include "admission.hpp"
+
+static const int kMaxEvents = 256;
+
+EventLoop::EventLoop(const ServerConfig& config)
+    : listenFd(-1), drainFd(lifecycle().drainFd()), running(false), drainRequested(false), draining(false),
+      idleTimeout(config.idleTimeout), maxOutput(config.maxOutput) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(epollFd < 0 || wakeFd < 0 || timerFd < 0) {
+    throw std::runtime_error(std::string("EventLoop setup failed: ") + strerror(errno));
+  }
+
+  struct epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+  if(config.idleTimeout > 0) {
+    struct itimerspec tick{};
+    tick.it_interval.tv_sec = 1;
+    tick.it_value.tv_sec = 1;
+    timerfd_settime(timerFd, 0, &tick, nullptr);
+    ev.data.fd = timerFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+  }
+}
+
+EventLoop::~EventLoop() {
+  for(auto& entry : connections) {
+    close(entry.first);
+  }
+  for(auto& entry : pending) {
+    close(entry.first);
+  }
+  if(listenFd >= 0) {
+    lifecycle().closeListener(listenFd);
+  }
+  close(timerFd);
+  close(wakeFd);
+  close(epollFd);
+}
+
+void EventLoop::addConnection(int client_fd) {
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pending.emplace_back(client_fd, monotonicNanos());
+  }
+  uint64_t one = 1;
+  ssize_t ignored = write(wakeFd, &one, sizeof(one));
+  (void)ignored;
+}
+
+void EventLoop::drain() {
+  drainRequested = true;
+  uint64_t one = 1;
+  ssize_t ignored = write(wakeFd, &one, sizeof(one));
+  (void)ignored;
+}
+
+void EventLoop::stop() {
+  running = false;
+  uint64_t one = 1;
+  ssize_t ignored = write(wakeFd, &one, sizeof(one));
+  (void)ignored;
+}
+
+void EventLoop::registerPending() {
+  uint64_t count;
+  while(read(wakeFd, &count, sizeof(count)) > 0) {
+  }
+
+  std::vector<std::pair<int, uint64_t>> fds;
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    fds.swap(pending);
+  }
+
+  for(auto& entry : fds) {
+    registerConnection(entry.first, entry.second);
+  }
+}
+
+void EventLoop::registerConnection(int fd, uint64_t acceptedNanos) {
+  struct epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.fd = fd;
+  if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close(fd);
+    admission().release();
+    return;
+  }
+  // Constructed in place: the session's arena must not move
+  Connection& conn = connections.try_emplace(fd, fd, &arenaPool).first->second;
+  conn.lastActive = Clock::now();
+  conn.idlePos = idleList.insert(idleList.end(), fd);
+  metrics().connectionOpened(acceptedNanos);
+}
+
+void EventLoop::addListener(int listen_fd) {
+  listenFd = listen_fd;
+  struct epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = listen_fd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+  // Level-triggered: it stays readable once the server drains
+  ev.events = EPOLLIN;
+  ev.data.fd = drainFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, drainFd, &ev);
+}
+
+void EventLoop::acceptAll() {
+  // Edge-triggered: accept everything queued before waiting again
+  while(true) {
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    int client_fd = accept4(listenFd, (struct sockaddr*)&peer, &peerLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(client_fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if(errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "Failed to accept client connection\n";
+      }
+      return;
+    }
+    if(admitConnection(client_fd, &peer)) {
+      registerConnection(client_fd, monotonicNanos());
+    }
+  }
+}
+
+void EventLoop::run() {
+  running = true;
+  struct epoll_event events[kMaxEvents];
+
+  while(running) {
+    int n = epoll_wait(epollFd, events, kMaxEvents, -1);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      std::cerr << "epoll_wait failed: " << strerror(errno) << "\n";
+      break;
+    }
+
+    for(int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if(fd == wakeFd) {
+        registerPending();
+        if(drainRequested && !draining) {
+          beginDrain();
+        }
+        continue;
+      }
+      if(fd == listenFd) {
+        acceptAll();
+        continue;
+      }
+      if(fd == timerFd) {
+        expireIdle();
+        continue;
+      }
+      if(fd == drainFd) {
+        beginDrain();
+        continue;
+      }
+
+      auto it = connections.find(fd);
+      if(it == connections.end()) {
+        continue;
+      }
+      Connection& conn = it->second;
+
+      if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+        closeConnection(fd);
+        continue;
+      }
+      if(events[i].events & EPOLLIN) {
+        onReadable(conn);
+        if(connections.find(fd) == connections.end()) {
+          continue;
+        }
+      }
+      if((events[i].events & EPOLLOUT) && !conn.out.empty()) {
+        if(!flush(conn)) {
+          closeConnection(fd);
+          continue;
+        }
+        // The client caught up: handle what the output cap held back and read again
+        if(conn.out.empty() && conn.session.outputFull) {
+          onReadable(conn);
+        }
+      }
+    }
+
+    if(draining && connections.empty()) {
+      break;  // drained
+    }
+  }
+}
+
+void EventLoop::onReadable(Connection& conn) {
+  char buffer[16384];
+  bool peerClosed = false;
+
+  while(true) {
+    // Edge-triggered: drain the socket until it would block. Requests are handled after
+    // every read, so a large upload streams to disk instead of piling up in conn.in.
+    // Reading stops while the output cap is reached; what is left in the socket
+    // buffer makes TCP flow control push back on the client.
+    while(!conn.session.outputFull) {
+      ssize_t nbytes = recv(conn.fd, buffer, sizeof(buffer), 0);
+      if(nbytes > 0) {
+        if(!conn.closeAfterWrite) {
+          conn.in.append(buffer, nbytes);
+          if(!processRequests(conn.session, conn.in, conn.out, maxOutput)) {
+            conn.closeAfterWrite = true;
+          }
+        }
+        continue;
+      }
+      if(nbytes == 0) {
+        peerClosed = true;
+        break;
+      }
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno != EAGAIN && errno != EWOULDBLOCK) {
+        closeConnection(conn.fd);
+        return;
+      }
+      break;
+    }
+    touch(conn);
+
+    if(peerClosed) {
+      conn.closeAfterWrite = true;
+    }
+
+    if(!flush(conn)) {
+      closeConnection(conn.fd);
+      return;
+    }
+    if(!conn.session.outputFull || !conn.out.empty()) {
+      return;  // waiting for input, or for EPOLLOUT
+    }
+
+    // Everything queued went straight out: handle the requests the cap held back
+    if(!processRequests(conn.session, conn.in, conn.out, maxOutput)) {
+      conn.closeAfterWrite = true;
+    }
+  }
+}
+
+// Write as much pending output as the socket accepts; the rest is resumed on the next
+// EPOLLOUT edge. Returns false if the connection should be dropped (hard error, or
+// done and not keep-alive).
+bool EventLoop::flush(Connection& conn) {
+  size_t queued = conn.out.size(), offset = conn.outOffset;
+  if(!writeResponses(conn.fd, conn.out, conn.outOffset, conn.sendStart)) {
+    return false;
+  }
+  // A client that is still taking in a response is not idle
+  if(conn.out.size() != queued || conn.outOffset != offset) {
+    touch(conn);
+  }
+  // A client that half-closed still gets the answers to the requests the cap held back
+  return !conn.out.empty() || !conn.closeAfterWrite || conn.session.outputFull;
+}
+
+void EventLoop::touch(Connection& conn) {
+  conn.lastActive = Clock::now();
+  idleList.splice(idleList.end(), idleList, conn.idlePos);
+}
+
+void EventLoop::expireIdle() {
+  uint64_t ticks;
+  while(read(timerFd, &ticks, sizeof(ticks)) > 0) {
+  }
+
+  Clock::time_point now = Clock::now();
+  if(idleTimeout.count() > 0) {
+    Clock::time_point cutoff = now - idleTimeout;
+    while(!idleList.empty()) {
+      auto it = connections.find(idleList.front());
+      if(it->second.lastActive > cutoff) {
+        break;
+      }
+      closeConnection(it->first);
+    }
+  }
+
+  if(!draining) {
+    return;
+  }
+  // Out of time to drain: close whatever is still open
+  if(now >= lifecycle().drainDeadline()) {
+    while(!connections.empty()) {
+      closeConnection(connections.begin()->first);
+    }
+  }
+  closeQuiet();
+}
+
+void EventLoop::beginDrain() {
+  draining = true;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, drainFd, nullptr);  // it stays readable; ENOENT when drain() was called
+  if(listenFd >= 0) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+    lifecycle().closeListener(listenFd);
+    listenFd = -1;
+  }
+
+  // Tick once a second to enforce the deadline, even without an idle timeout
+  struct itimerspec tick{};
+  tick.it_interval.tv_sec = 1;
+  tick.it_value.tv_sec = 1;
+  timerfd_settime(timerFd, 0, &tick, nullptr);
+  struct epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = timerFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);  // EEXIST when already ticking
+
+  closeQuiet();
+}
+
+// While draining: close the connections with nothing in progress that have been quiet for
+// kDrainGrace. The rest close after their next response, or on a later tick.
+void EventLoop::closeQuiet() {
+  Clock::time_point cutoff = Clock::now() - kDrainGrace;
+  std::vector<int> quiet;
+  for(int fd : idleList) {
+    Connection& conn = connections.find(fd)->second;
+    if(conn.lastActive > cutoff) {
+      break;
+    }
+    if(conn.in.empty() && conn.out.empty() && !conn.session.upload && !conn.session.outputFull && clientIdle(fd)) {
+      quiet.push_back(fd);
+    }
+  }
+  for(int fd : quiet) {
+    closeConnection(fd);
+  }
+}
+
+void EventLoop::closeConnection(int fd) {
+  auto it = connections.find(fd);
+  if(it == connections.end()) {
+    return;
+  }
+  idleList.erase(it->second.idlePos);
+  connections.erase(it);
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  metrics().connectionClosed();
+  admission().release();
+}
+
+static void setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int runEpollServer(int listen_fd, const ServerConfig& config) {
+  setNonBlocking(listen_fd);
+
+  std::vector<std::unique_ptr<EventLoop>> loops;
+  std::vector<std::thread> threads;
+  for(unsigned i = 0; i < config.workers; ++i) {
+    loops.emplace_back(new EventLoop(config));
+  }
+  for(auto& loop : loops) {
+    threads.emplace_back(&EventLoop::run, loop.get());
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = listen_fd;
+  if(epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+    std::cerr << "Failed to set up accept epoll\n";
+    return 1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.fd = lifecycle().drainFd();
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+  std::cout << "Waiting for clients to connect (" << config.workers << " epoll workers)...\n";
+  lifecycle().serving();
+
+  size_t next = 0;
+  bool failed = false;
+  struct epoll_event events[16];
+  while(!lifecycle().draining()) {
+    int n = epoll_wait(epoll_fd, events, 16, -1);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      std::cerr << "epoll_wait failed on listening socket\n";
+      failed = true;
+      break;
+    }
+
+    // Edge-triggered: accept everything queued before waiting again. Connections over
+    // budget are turned away here, before a worker spends anything on them.
+    while(true) {
+      struct sockaddr_in peer;
+      socklen_t peerLength = sizeof(peer);
+      int client_fd = accept4(listen_fd, (struct sockaddr*)&peer, &peerLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if(client_fd < 0) {
+        if(errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+          std::cerr << "Failed to accept client connection\n";
+        }
+        break;
+      }
+      if(!admitConnection(client_fd, &peer)) {
+        continue;
+      }
+      loops[next]->addConnection(client_fd);
+      next = (next + 1) % loops.size();
+    }
+  }
+
+  // Stop accepting, then let the loops finish the connections they were handed
+  lifecycle().closeListener(listen_fd);
+  for(auto& loop : loops) {
+    if(failed) {
+      loop->stop();
+    }
+    else {
+      loop->drain();
+    }
+  }
+  for(auto& t : threads) {
+    t.join();
+  }
+  close(epoll_fd);
+  return failed ? 1 : 0;
+}
+
+void pinCurrentThreadToCpu(unsigned cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    std::cerr << "Failed to pin listener to CPU " << cpu << "\n";
+  }
+}
+
+int runReuseportServer(const ServerConfig& config) {
+  std::vector<int> listen_fds;
+  for(unsigned i = 0; i < config.listeners; ++i) {
+    int fd = lifecycle().openListener(config.port, config.backlog);
+    if(fd < 0) {
+      for(int opened : listen_fds) {
+        lifecycle().closeListener(opened);
+      }
+      return 1;
+    }
+    setNonBlocking(fd);
+    listen_fds.push_back(fd);
+  }
+
+  std::cout << "Waiting for clients to connect (" << config.listeners << " reuseport listeners"
+            << (config.pinCpus ? ", pinned" : "") << ")...\n";
+  lifecycle().serving();
+
+  std::vector<std::thread> threads;
+  for(unsigned i = 0; i < config.listeners; ++i) {
+    threads.emplace_back([&config, &listen_fds, i]() {
+      if(config.pinCpus) {
+        pinCurrentThreadToCpu(i);
+      }
+      EventLoop loop(config);
+      loop.addListener(listen_fds[i]);
+      loop.run();
+    });
+  }
+
+  // Each loop closed its own socket when draining began
+  for(auto& t : threads) {
+    t.join();
+  }
+  return 0;
+}
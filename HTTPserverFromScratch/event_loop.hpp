@@ -0,0 +1,105 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <list>
+#include <deque>
+#include <chrono>
+#include <memory_resource>
+#include "config.hpp"
+#include "server.hpp"
+
+// A single-threaded, edge-triggered epoll reactor. Each worker thread owns one
+// EventLoop and every connection handed to it, so connection state is never shared.
+class EventLoop {
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection {
+      int fd;
+      std::string in;          // bytes received but not yet handled
+      HttpSession session;     // parser and upload state for the request at the front of `in`
+      std::deque<HttpResponse> out;  // responses not yet fully written, oldest first
+      size_t outOffset = 0;          // bytes of out.front() already written
+      uint64_t sendStart = 0;        // when writing out.front() began, for the send-phase metric
+      bool closeAfterWrite = false;
+      Clock::time_point lastActive;
+      std::list<int>::iterator idlePos;
+
+      Connection(int fd, std::pmr::memory_resource* upstream) : fd(fd), session(upstream) {}
+    };
+
+    int epollFd;
+    int listenFd;              // set when this loop accepts for itself (reuseport mode); owned by the loop
+    int wakeFd;                // eventfd used to hand new connections over from the acceptor
+    int timerFd;               // periodic tick for closing idle keep-alive connections
+    int drainFd;               // lifecycle().drainFd(), watched by loops with their own listener
+    std::atomic<bool> running;
+    std::atomic<bool> drainRequested;  // set by drain()
+    bool draining;             // no more accepts; connections close once idle, or at the deadline
+    std::chrono::seconds idleTimeout;
+    size_t maxOutput;          // per-connection cap on queued response bytes
+
+    // Connections ordered by last activity, oldest first, so expiry never scans them all
+    std::list<int> idleList;
+
+    std::mutex pendingMutex;
+    std::vector<std::pair<int, uint64_t>> pending;  // accepted fds and their accept times, waiting to be registered
+
+    // Backs the per-connection arenas once they outgrow their inline block; must outlive connections
+    std::pmr::unsynchronized_pool_resource arenaPool;
+    std::unordered_map<int, Connection> connections;
+
+    void registerPending();
+    void registerConnection(int fd, uint64_t acceptedNanos);
+    void acceptAll();
+    void onReadable(Connection& conn);
+    bool flush(Connection& conn);
+    void touch(Connection& conn);
+    void expireIdle();
+    void beginDrain();
+    void closeQuiet();
+    void closeConnection(int fd);
+
+  public:
+    explicit EventLoop(const ServerConfig& config);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Hand a non-blocking client socket to this loop. Safe to call from any thread.
+    void addConnection(int client_fd);
+
+    // Let this loop accept directly from its own (reuseport) listening socket. It then
+    // follows lifecycle() itself, closing the socket and draining when the server drains.
+    void addListener(int listen_fd);
+
+    // Drain once every connection handed over so far is registered: the acceptor calls
+    // this after its last addConnection(). Safe to call from any thread.
+    void drain();
+
+    // Process events until stop() is called, or until the server drains and every
+    // connection of this loop has been closed
+    void run();
+
+    // Ask run() to return. Safe to call from any thread.
+    void stop();
+};
+
+// Accept on listen_fd and spread connections round-robin over config.workers event loops.
+// Takes ownership of listen_fd and returns once the server has drained.
+int runEpollServer(int listen_fd, const ServerConfig& config);
+
+// Pin the calling thread to one CPU (taken modulo the CPU count)
+void pinCurrentThreadToCpu(unsigned cpu);
+
+// Start config.listeners threads, each with its own SO_REUSEPORT socket and event
+// loop, so the kernel spreads new connections across them without a shared accept
+int runReuseportServer(const ServerConfig& config);
+
+#endif // EVENT_LOOP_HPP
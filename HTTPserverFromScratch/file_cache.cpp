@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "file_cache.hpp"
+#include "http_conditional.hpp"
+
+OpenFile::OpenFile(int fd, size_t size, const struct timespec& mtime, ino_t inode)
+    : fd(fd), size(size), mtime(mtime), inode(inode), lastModified(formatHttpDate(mtime.tv_sec)) {
+  char tag[64];
+  snprintf(tag, sizeof(tag), "\"%lx-%zx-%lx.%lx\"", (unsigned long)inode, size,
+           (unsigned long)mtime.tv_sec, (unsigned long)mtime.tv_nsec);
+  etag = tag;
+}
+
+OpenFile::~OpenFile() {
+  close(fd);
+}
+
+static bool sameFile(const OpenFile& file, const struct stat& st) {
+  return file.inode == st.st_ino && file.size == (size_t)st.st_size &&
+         file.mtime.tv_sec == st.st_mtim.tv_sec && file.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+FileCache::FileCache(size_t capacity, Clock::duration revalidateInterval)
+    : capacity(capacity), revalidateInterval(revalidateInterval) {
+}
+
+std::shared_ptr<const OpenFile> FileCache::open(const std::string& path) {
+  Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto it = entries.find(path);
+  if(it != entries.end()) {
+    Entry& entry = it->second;
+    lru.splice(lru.begin(), lru, entry.lruPos);
+    if(now - entry.checkedAt < revalidateInterval) {
+      return entry.file;
+    }
+
+    // Time to look at the file again: keep the descriptor only if nothing changed
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && sameFile(*entry.file, st)) {
+      entry.checkedAt = now;
+      return entry.file;
+    }
+    lru.erase(entry.lruPos);
+    entries.erase(it);
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return nullptr;
+  }
+
+  evictIfFull();
+  Entry entry;
+  entry.file = std::make_shared<const OpenFile>(fd, st.st_size, st.st_mtim, st.st_ino);
+  entry.checkedAt = now;
+  entry.lruPos = lru.insert(lru.begin(), path);
+  auto inserted = entries.emplace(path, std::move(entry));
+  return inserted.first->second.file;
+}
+
+void FileCache::evictIfFull() {
+  while(entries.size() >= capacity && !lru.empty()) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
+void FileCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  lru.clear();
+}
+
+FileCache& fileCache() {
+  static FileCache cache;
+  return cache;
+}
@@ -0,0 +1,67 @@
+#ifndef FILE_CACHE_HPP
+#define FILE_CACHE_HPP
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <chrono>
+#include <unordered_map>
+#include <sys/types.h>
+#include <time.h>
+
+// A regular file held open for serving. The descriptor is closed when the last
+// reference goes away, so a response in flight keeps its file alive even if the
+// cache has already replaced or evicted the entry. The validators for conditional
+// requests are formatted once here, not per request.
+struct OpenFile {
+  int fd;
+  size_t size;
+  struct timespec mtime;
+  ino_t inode;
+  std::string etag;          // strong validator built from inode, size and mtime, with its quotes
+  std::string lastModified;  // mtime as an HTTP date
+
+  OpenFile(int fd, size_t size, const struct timespec& mtime, ino_t inode);
+  ~OpenFile();
+
+  OpenFile(const OpenFile&) = delete;
+  OpenFile& operator=(const OpenFile&) = delete;
+};
+
+// Bounded LRU cache of open file descriptors and their stat() results, shared by all
+// worker threads. An entry is re-validated with stat() at most once per
+// revalidateInterval and reopened when its mtime, size or inode changed.
+class FileCache {
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+      std::shared_ptr<const OpenFile> file;
+      Clock::time_point checkedAt;
+      std::list<std::string>::iterator lruPos;
+    };
+
+    std::mutex mutex;
+    size_t capacity;
+    Clock::duration revalidateInterval;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // most recently used at the front
+
+    void evictIfFull();
+
+  public:
+    explicit FileCache(size_t capacity = 1024,
+                       Clock::duration revalidateInterval = std::chrono::seconds(1));
+
+    // Return the open file for path, or nullptr if it does not exist or is not a regular file
+    std::shared_ptr<const OpenFile> open(const std::string& path);
+
+    // Drop every cached descriptor
+    void clear();
+};
+
+// Process-wide cache used by the request handlers
+FileCache& fileCache();
+
+#endif // FILE_CACHE_HPP
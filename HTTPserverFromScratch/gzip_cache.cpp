@@ -0,0 +1,261 @@
+#include <cctype>
+#include <cstdlib>
+#include <unistd.h>
+#include <zlib.h>
+#include "gzip_cache.hpp"
+
+// A compressed variant is only kept if it saves at least a tenth of the bytes
+static const double kMaxGzipRatio = 0.9;
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  if(a.size() != b.size()) {
+    return false;
+  }
+  for(size_t i = 0; i < a.size(); ++i) {
+    if(std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string_view trim(std::string_view s) {
+  while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+bool acceptsGzip(std::string_view acceptEncoding) {
+  // e.g. "gzip, deflate, br" or "br;q=1.0, gzip;q=0.8, *;q=0.1"
+  int gzip = -1;  // -1 = not mentioned, 0 = refused, 1 = accepted
+  int wildcard = -1;
+  while(!acceptEncoding.empty()) {
+    size_t comma = acceptEncoding.find(',');
+    std::string_view item = acceptEncoding.substr(0, comma);
+    acceptEncoding = comma == std::string_view::npos ? std::string_view() : acceptEncoding.substr(comma + 1);
+
+    size_t semicolon = item.find(';');
+    std::string_view coding = trim(item.substr(0, semicolon));
+    bool allowed = true;
+    if(semicolon != std::string_view::npos) {
+      std::string_view param = trim(item.substr(semicolon + 1));
+      if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+        allowed = std::strtod(std::string(param.substr(2)).c_str(), nullptr) > 0;
+      }
+    }
+    if(equalsIgnoreCase(coding, "gzip") || equalsIgnoreCase(coding, "x-gzip")) {
+      gzip = allowed;
+    }
+    else if(coding == "*") {
+      wildcard = allowed;
+    }
+  }
+  return gzip >= 0 ? gzip == 1 : wildcard == 1;
+}
+
+std::string gzipEtag(const OpenFile& file) {
+  std::string tag = file.etag;
+  tag.insert(tag.size() - 1, "-gz");
+  return tag;
+}
+
+bool compressibleType(std::string_view path) {
+  static const char* const extensions[] = {
+    "html", "htm", "css", "js", "mjs", "json", "txt", "xml", "svg", "csv", "md", "map"
+  };
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+  if(dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash)) {
+    return false;
+  }
+  std::string_view extension = path.substr(dot + 1);
+  for(const char* known : extensions) {
+    if(equalsIgnoreCase(extension, known)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool siblingUpToDate(const OpenFile& sibling, const OpenFile& file) {
+  return sibling.mtime.tv_sec > file.mtime.tv_sec ||
+         (sibling.mtime.tv_sec == file.mtime.tv_sec && sibling.mtime.tv_nsec >= file.mtime.tv_nsec);
+}
+
+static bool sameVersion(size_t size, const struct timespec& mtime, ino_t inode, const OpenFile& file) {
+  return inode == file.inode && size == file.size &&
+         mtime.tv_sec == file.mtime.tv_sec && mtime.tv_nsec == file.mtime.tv_nsec;
+}
+
+static bool readAll(const OpenFile& file, std::string& out) {
+  out.resize(file.size);
+  size_t done = 0;
+  while(done < file.size) {
+    ssize_t nbytes = pread(file.fd, &out[done], file.size - done, done);
+    if(nbytes <= 0) {
+      return false;
+    }
+    done += nbytes;
+  }
+  return true;
+}
+
+GzipCache::GzipCache(size_t budgetBytes, size_t maxFileBytes, int level)
+    : budgetBytes(budgetBytes), maxFileBytes(maxFileBytes), level(level), usedBytes(0),
+      hits(0), misses(0), compressions(0) {
+}
+
+void GzipCache::configure(size_t budget, size_t maxFile, int newLevel) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budgetBytes = budget;
+  maxFileBytes = maxFile;
+  level = newLevel;
+  while(usedBytes > budgetBytes && !lru.empty()) {
+    eraseLocked(entries.find(lru.back()));
+  }
+}
+
+void GzipCache::eraseLocked(std::unordered_map<std::string, Entry>::iterator it) {
+  if(it->second.response) {
+    usedBytes -= it->second.response->size();
+  }
+  lru.erase(it->second.lruPos);
+  entries.erase(it);
+}
+
+bool GzipCache::build(const std::string& path, const OpenFile& file, std::shared_ptr<const std::string>& response) {
+  std::string body;
+
+  // A sibling compressed ahead of time (e.g. with gzip -9) beats anything done here,
+  // as long as it is not older than the file it was made from
+  std::shared_ptr<const OpenFile> sibling = fileCache().open(path + ".gz");
+  if(sibling && sibling->size <= maxFileBytes && siblingUpToDate(*sibling, file)) {
+    if(!readAll(*sibling, body)) {
+      return false;
+    }
+  }
+  else {
+    std::string raw;
+    if(!readAll(file, raw)) {
+      return false;
+    }
+
+    // windowBits 15 + 16 selects the gzip wrapper instead of raw zlib
+    z_stream stream{};
+    if(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    body.resize(deflateBound(&stream, raw.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(&raw[0]);
+    stream.avail_in = raw.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&body[0]);
+    stream.avail_out = body.size();
+    int rc = deflate(&stream, Z_FINISH);
+    body.resize(stream.total_out);
+    deflateEnd(&stream);
+    compressions.fetch_add(1, std::memory_order_relaxed);
+    if(rc != Z_STREAM_END) {
+      return false;
+    }
+    if(body.size() > raw.size() * kMaxGzipRatio) {
+      response.reset();
+      return true;  // not worth a Content-Encoding
+    }
+  }
+
+  auto built = std::make_shared<std::string>();
+  built->reserve(body.size() + 128);
+  built->append("HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+  built->append("ETag: ").append(gzipEtag(file)).append("\r\nLast-Modified: ").append(file.lastModified);
+  built->append("\r\nContent-Length: ");
+  built->append(std::to_string(body.size())).append("\r\n\r\n").append(body);
+  response = built;
+  return true;
+}
+
+std::shared_ptr<const std::string> GzipCache::get(const std::string& path, const OpenFile& file) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if(it != entries.end()) {
+      Entry& entry = it->second;
+      if(sameVersion(entry.fileSize, entry.mtime, entry.inode, file)) {
+        if(entry.state == Compressing) {
+          return nullptr;  // someone else is on it; this request goes out uncompressed
+        }
+        lru.splice(lru.begin(), lru, entry.lruPos);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return entry.response;  // null for Incompressible
+      }
+      if(entry.state == Compressing) {
+        return nullptr;  // an older version is being compressed; let that finish first
+      }
+      eraseLocked(it);  // stale: the file changed since it was compressed
+    }
+
+    // Claim the file so concurrent requests do not compress it too
+    misses.fetch_add(1, std::memory_order_relaxed);
+    Entry entry;
+    entry.state = Compressing;
+    entry.fileSize = file.size;
+    entry.mtime = file.mtime;
+    entry.inode = file.inode;
+    entry.lruPos = lru.insert(lru.begin(), path);
+    entries.emplace(path, std::move(entry));
+  }
+
+  // Compress without holding the lock
+  std::shared_ptr<const std::string> response;
+  bool ok = build(path, file, response);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(path);
+  if(it == entries.end() || it->second.state != Compressing ||
+     !sameVersion(it->second.fileSize, it->second.mtime, it->second.inode, file)) {
+    return response;  // our claim was evicted meanwhile; still use the result once
+  }
+  if(!ok) {
+    eraseLocked(it);  // read error: try again next time
+    return nullptr;
+  }
+  if(!response) {
+    it->second.state = Incompressible;
+    return nullptr;
+  }
+  if(response->size() > budgetBytes) {
+    eraseLocked(it);
+    return response;
+  }
+
+  it->second.state = Ready;
+  it->second.response = response;
+  usedBytes += response->size();
+  while(usedBytes > budgetBytes && lru.size() > 1) {
+    auto victim = entries.find(lru.back());
+    if(victim == it) {
+      break;
+    }
+    eraseLocked(victim);
+  }
+  return response;
+}
+
+GzipCache::Stats GzipCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  Stats s;
+  s.hits = hits.load(std::memory_order_relaxed);
+  s.misses = misses.load(std::memory_order_relaxed);
+  s.compressions = compressions.load(std::memory_order_relaxed);
+  s.bytes = usedBytes;
+  s.entries = entries.size();
+  return s;
+}
+
+GzipCache& gzipCache() {
+  static GzipCache cache;
+  return cache;
+}
@@ -0,0 +1,99 @@
+#ifndef GZIP_CACHE_HPP
+#define GZIP_CACHE_HPP
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include "file_cache.hpp"
+
+// Files smaller than this are not worth a Content-Encoding header
+const size_t kMinGzipBytes = 256;
+
+// Whether an Accept-Encoding header value allows gzip (and does not give it q=0)
+bool acceptsGzip(std::string_view acceptEncoding);
+
+// Whether a precompressed sibling is at least as new as the file it was made from
+bool siblingUpToDate(const OpenFile& sibling, const OpenFile& file);
+
+// Entity tag of the gzip-encoded variant of file: the file's own tag with "-gz" added
+// inside the quotes
+std::string gzipEtag(const OpenFile& file);
+
+// Whether the file's extension marks it as text-like content that compresses well
+bool compressibleType(std::string_view path);
+
+// Bounded LRU cache of complete gzip-encoded GET responses (status line, headers and
+// compressed body), keyed by path and by the version of the file they were built from.
+// A file is compressed once, on the first request that accepts gzip; while that is in
+// progress, other requests for it are answered uncompressed instead of compressing it
+// again. A `<path>.gz` sibling written ahead of time is used instead of compressing.
+// Files that do not shrink are remembered too, so they are not tried again.
+class GzipCache {
+  public:
+    struct Stats {
+      unsigned long hits;
+      unsigned long misses;
+      unsigned long compressions;  // files run through deflate (not counting .gz siblings)
+      size_t bytes;
+      size_t entries;
+    };
+
+  private:
+    enum State { Compressing, Ready, Incompressible };
+
+    struct Entry {
+      State state;
+      std::shared_ptr<const std::string> response;
+      size_t fileSize;
+      struct timespec mtime;
+      ino_t inode;
+      std::list<std::string>::iterator lruPos;
+    };
+
+    std::mutex mutex;
+    size_t budgetBytes;
+    size_t maxFileBytes;
+    int level;
+    size_t usedBytes;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // most recently used at the front
+
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> compressions;
+
+    void eraseLocked(std::unordered_map<std::string, Entry>::iterator it);
+    // Build the gzip response for file into `response` (left null if it does not shrink).
+    // Returns false if the file could not be read.
+    bool build(const std::string& path, const OpenFile& file, std::shared_ptr<const std::string>& response);
+
+  public:
+    GzipCache(size_t budgetBytes = 16 * 1024 * 1024, size_t maxFileBytes = 1024 * 1024, int level = 6);
+
+    // Change the limits and compression level (0 = gzip off); entries over the new budget are evicted
+    void configure(size_t budgetBytes, size_t maxFileBytes, int level);
+
+    bool enabled() const { return level > 0; }
+
+    // Whether a file of this name and size is compressed on the fly and cached
+    bool eligible(std::string_view path, size_t fileSize) const {
+      return enabled() && budgetBytes > 0 && fileSize >= kMinGzipBytes && fileSize <= maxFileBytes &&
+             compressibleType(path);
+    }
+
+    // The gzip response for this version of file, compressing it on first use. nullptr when
+    // it does not compress, cannot be read, or another thread is compressing it right now:
+    // answer uncompressed then.
+    std::shared_ptr<const std::string> get(const std::string& path, const OpenFile& file);
+
+    Stats stats();
+};
+
+// Process-wide cache used by the request handlers
+GzipCache& gzipCache();
+
+#endif // GZIP_CACHE_HPP
@@ -0,0 +1,219 @@
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <charconv>
+#include <algorithm>
+#include "http_conditional.hpp"
+
+static const char* const kDays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* const kMonths[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                      "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  if(a.size() != b.size()) {
+    return false;
+  }
+  for(size_t i = 0; i < a.size(); ++i) {
+    if(std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string_view trim(std::string_view s) {
+  while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+// Split the next comma-separated element off the front of list
+static std::string_view nextElement(std::string_view& list) {
+  size_t comma = list.find(',');
+  std::string_view item = list.substr(0, comma);
+  list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+  return trim(item);
+}
+
+// A decimal number that must fill all of text
+static bool parseInt(std::string_view text, int& value) {
+  const char* end = text.data() + text.size();
+  auto result = std::from_chars(text.data(), end, value);
+  return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+std::string formatHttpDate(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char text[32];
+  // Built by hand so the names do not depend on the locale
+  snprintf(text, sizeof(text), "%s, %02d %s %04d %02d:%02d:%02d GMT", kDays[tm.tm_wday], tm.tm_mday,
+           kMonths[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  return text;
+}
+
+bool parseHttpDate(std::string_view text, time_t& t) {
+  // "Sun, 06 Nov 1994 08:49:37 GMT"; the obsolete RFC 850 and asctime forms are not accepted
+  text = trim(text);
+  if(text.size() != 29 || text.substr(3, 2) != ", " || text[7] != ' ' || text[11] != ' ' ||
+     text[16] != ' ' || text[19] != ':' || text[22] != ':' || text.substr(25) != " GMT") {
+    return false;
+  }
+
+  struct tm tm{};
+  tm.tm_mon = -1;
+  for(int i = 0; i < 12; ++i) {
+    if(text.substr(8, 3) == kMonths[i]) {
+      tm.tm_mon = i;
+    }
+  }
+  int year;
+  if(tm.tm_mon < 0 || !parseInt(text.substr(5, 2), tm.tm_mday) || !parseInt(text.substr(12, 4), year) ||
+     !parseInt(text.substr(17, 2), tm.tm_hour) || !parseInt(text.substr(20, 2), tm.tm_min) ||
+     !parseInt(text.substr(23, 2), tm.tm_sec)) {
+    return false;
+  }
+  tm.tm_year = year - 1900;
+  t = timegm(&tm);
+  return true;
+}
+
+static std::string_view opaqueTag(std::string_view etag) {
+  if(etag.size() >= 2 && etag[0] == 'W' && etag[1] == '/') {
+    etag.remove_prefix(2);
+  }
+  return etag;
+}
+
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+  if(trim(ifNoneMatch) == "*") {
+    return true;
+  }
+  std::string_view wanted = opaqueTag(etag);
+  while(!ifNoneMatch.empty()) {
+    if(opaqueTag(nextElement(ifNoneMatch)) == wanted) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool notModified(std::string_view ifNoneMatch, std::string_view ifModifiedSince,
+                 std::string_view etag, time_t lastModified) {
+  if(!ifNoneMatch.empty()) {
+    return etagMatches(ifNoneMatch, etag);
+  }
+  time_t since;
+  return !ifModifiedSince.empty() && parseHttpDate(ifModifiedSince, since) && lastModified <= since;
+}
+
+bool ifRangeMatches(std::string_view ifRange, std::string_view etag, time_t lastModified) {
+  ifRange = trim(ifRange);
+  if(ifRange.empty()) {
+    return true;
+  }
+  if(ifRange.front() == '"' || ifRange.substr(0, 2) == "W/") {
+    return ifRange == etag;  // a weak tag never matches strongly
+  }
+  time_t date;
+  return parseHttpDate(ifRange, date) && date == lastModified;
+}
+
+// A byte position; values too large for size_t saturate, so they are just past any file
+static bool parsePosition(std::string_view text, size_t& value) {
+  const char* end = text.data() + text.size();
+  unsigned long long parsed = 0;
+  auto result = std::from_chars(text.data(), end, parsed);
+  if(text.empty() || result.ptr != end) {
+    return false;
+  }
+  if(result.ec == std::errc::result_out_of_range) {
+    value = SIZE_MAX;
+    return true;
+  }
+  value = parsed;
+  return result.ec == std::errc();
+}
+
+RangeStatus parseRange(std::string_view header, size_t size, std::vector<ByteRange>& ranges) {
+  // e.g. "bytes=0-499", "bytes=500-", "bytes=-500" or "bytes=0-99, 200-299"
+  header = trim(header);
+  if(header.size() < 6 || !equalsIgnoreCase(header.substr(0, 6), "bytes=")) {
+    return RangeIgnored;
+  }
+  header.remove_prefix(6);
+
+  ranges.clear();
+  size_t specs = 0;
+  while(!header.empty()) {
+    std::string_view spec = nextElement(header);
+    if(spec.empty()) {
+      continue;  // lists may contain empty elements
+    }
+    if(++specs > kMaxRanges) {
+      return RangeIgnored;
+    }
+    size_t dash = spec.find('-');
+    if(dash == std::string_view::npos) {
+      return RangeIgnored;
+    }
+    std::string_view firstText = trim(spec.substr(0, dash));
+    std::string_view lastText = trim(spec.substr(dash + 1));
+
+    size_t first, last;
+    if(firstText.empty()) {
+      // Suffix range: the final N bytes
+      size_t suffix;
+      if(!parsePosition(lastText, suffix)) {
+        return RangeIgnored;
+      }
+      if(suffix == 0 || size == 0) {
+        continue;
+      }
+      first = suffix >= size ? 0 : size - suffix;
+      last = size - 1;
+    }
+    else {
+      if(!parsePosition(firstText, first)) {
+        return RangeIgnored;
+      }
+      last = SIZE_MAX;
+      if(!lastText.empty() && (!parsePosition(lastText, last) || last < first)) {
+        return RangeIgnored;
+      }
+      if(first >= size) {
+        continue;  // starts past the end
+      }
+      last = std::min(last, size - 1);
+    }
+    ranges.push_back(ByteRange{first, last - first + 1});
+  }
+
+  if(specs == 0) {
+    return RangeIgnored;
+  }
+  if(ranges.empty()) {
+    return RangeNotSatisfiable;
+  }
+
+  // Overlapping or adjacent ranges go out as one part
+  std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) {
+    return a.first < b.first;
+  });
+  size_t merged = 0;
+  for(size_t i = 1; i < ranges.size(); ++i) {
+    ByteRange& last = ranges[merged];
+    if(ranges[i].first <= last.first + last.length) {
+      last.length = std::max(last.first + last.length, ranges[i].first + ranges[i].length) - last.first;
+    }
+    else {
+      ranges[++merged] = ranges[i];
+    }
+  }
+  ranges.resize(merged + 1);
+  return RangeSatisfiable;
+}
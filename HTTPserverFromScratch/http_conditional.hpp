@@ -0,0 +1,49 @@
+#ifndef HTTP_CONDITIONAL_HPP
+#define HTTP_CONDITIONAL_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <time.h>
+
+// Most ranges served in one multipart/byteranges response; longer Range headers are ignored
+const size_t kMaxRanges = 16;
+
+// One satisfiable byte range of a file
+struct ByteRange {
+  size_t first;
+  size_t length;
+};
+
+enum RangeStatus {
+  RangeIgnored,        // no usable Range header: send the whole file with 200
+  RangeSatisfiable,    // send the ranges with 206
+  RangeNotSatisfiable  // no range overlaps the file: 416
+};
+
+// Format t as an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT")
+std::string formatHttpDate(time_t t);
+
+// Parse an IMF-fixdate. Returns false for anything else, which callers ignore.
+bool parseHttpDate(std::string_view text, time_t& t);
+
+// Whether an If-None-Match value ("*" or a list of entity tags) matches etag, with the
+// weak comparison RFC 9110 asks for (W/ prefixes are ignored)
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+
+// Whether the conditions of a GET mean the client's copy is current and 304 should be
+// sent. If-None-Match takes precedence; If-Modified-Since only counts when it is absent.
+bool notModified(std::string_view ifNoneMatch, std::string_view ifModifiedSince,
+                 std::string_view etag, time_t lastModified);
+
+// Whether an If-Range value (an entity tag or a date) still names this version of the
+// file, so the Range header applies. Needs a strong match.
+bool ifRangeMatches(std::string_view ifRange, std::string_view etag, time_t lastModified);
+
+// Parse a "bytes=" Range header against a file of size bytes. Satisfiable ranges are
+// clamped to the file, sorted and merged where they overlap or touch, and stored in
+// ranges. Headers that are malformed or ask for more than kMaxRanges ranges are ignored.
+RangeStatus parseRange(std::string_view header, size_t size, std::vector<ByteRange>& ranges);
+
+#endif // HTTP_CONDITIONAL_HPP
@@ -0,0 +1,251 @@
+#include <cstring>
+#include <strings.h>
+#include "http_parser.hpp"
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// RFC 7230 tchar: characters allowed in methods and header names
+struct TokenTable {
+  bool allowed[256];
+
+  TokenTable() : allowed() {
+    for(int c = 0; c < 256; ++c) {
+      allowed[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                   (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+    }
+  }
+};
+
+static const TokenTable kTokenTable;
+
+static bool isTokenChar(char c) {
+  return kTokenTable.allowed[(unsigned char)c];
+}
+
+// Parse a non-negative decimal Content-Length. Returns false on junk or overflow.
+static bool parseLength(std::string_view text, size_t& length) {
+  if(text.empty()) {
+    return false;
+  }
+  size_t value = 0;
+  for(char c : text) {
+    if(c < '0' || c > '9') {
+      return false;
+    }
+    size_t next = value * 10 + (c - '0');
+    if(next / 10 != value) {
+      return false;
+    }
+    value = next;
+  }
+  length = value;
+  return true;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+  for(size_t i = 0; i < headerCount; ++i) {
+    if(equalsIgnoreCase(headers[i].name, name)) {
+      return headers[i].value;
+    }
+  }
+  return std::string_view();
+}
+
+HttpParser::HttpParser() {
+  reset();
+}
+
+void HttpParser::reset() {
+  state = Method;
+  pos = 0;
+  method = target = version = Span{0, 0};
+  headerCount = 0;
+  errorStatus = 0;
+}
+
+HttpParser::Status HttpParser::fail(int status) {
+  errorStatus = status;
+  return Error;
+}
+
+HttpParser::Status HttpParser::parse(const char* data, size_t len, HttpRequest& request) {
+  if(errorStatus != 0) {
+    return Error;
+  }
+
+  for(; state != Done && pos < len; ++pos) {
+    char c = data[pos];
+    switch(state) {
+      case Method:
+        if(c == ' ') {
+          method.end = pos;
+          if(method.end == method.begin) {
+            return fail(400);
+          }
+          target.begin = pos + 1;
+          state = Target;
+        }
+        else if(!isTokenChar(c)) {
+          return fail(400);
+        }
+        break;
+
+      case Target:
+        if(c == ' ') {
+          target.end = pos;
+          if(target.end == target.begin) {
+            return fail(400);
+          }
+          version.begin = pos + 1;
+          state = Version;
+        }
+        else if(c == '\r' || c == '\n') {
+          return fail(400);
+        }
+        break;
+
+      case Version:
+        if(c == '\r' || c == '\n') {
+          version.end = pos;
+          state = (c == '\r') ? RequestLineEnd : HeaderStart;
+        }
+        break;
+
+      case RequestLineEnd:
+        if(c != '\n') {
+          return fail(400);
+        }
+        state = HeaderStart;
+        break;
+
+      case HeaderStart:
+        if(c == '\r') {
+          state = HeadEnd;
+        }
+        else if(c == '\n') {
+          state = Done;  // bare LF ends the head too
+        }
+        else if(!isTokenChar(c)) {
+          return fail(400);
+        }
+        else if(headerCount == kMaxRequestHeaders) {
+          return fail(431);
+        }
+        else {
+          names[headerCount].begin = pos;
+          state = HeaderName;
+        }
+        break;
+
+      case HeaderName:
+        if(c == ':') {
+          names[headerCount].end = pos;
+          state = HeaderValueStart;
+        }
+        else if(!isTokenChar(c)) {
+          return fail(400);
+        }
+        break;
+
+      case HeaderValueStart:
+        if(c == ' ' || c == '\t') {
+          break;
+        }
+        values[headerCount].begin = pos;
+        state = HeaderValue;
+        --pos;  // look at c again as the first byte of the value (or the end of an empty one)
+        break;
+
+      case HeaderValue: {
+        // Values are opaque: jump straight to the end of the line
+        const char* lf = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+        if(lf == nullptr) {
+          pos = len - 1;  // whole remainder is value; the loop increment stops at len
+          break;
+        }
+        pos = lf - data;
+        size_t end = pos;
+        if(end > values[headerCount].begin && data[end - 1] == '\r') {
+          --end;
+        }
+        while(end > values[headerCount].begin && (data[end - 1] == ' ' || data[end - 1] == '\t')) {
+          --end;
+        }
+        values[headerCount].end = end;
+        ++headerCount;
+        state = HeaderStart;
+        break;
+      }
+
+      case HeadEnd:
+        if(c != '\n') {
+          return fail(400);
+        }
+        state = Done;
+        break;
+
+      case Done:
+        break;
+    }
+  }
+
+  if(state != Done) {
+    return pos > kMaxHeaderBytes ? fail(431) : Incomplete;
+  }
+  if(pos > kMaxHeaderBytes) {
+    return fail(431);
+  }
+
+  // Turn the recorded offsets into views into the caller's buffer
+  request.method = std::string_view(data + method.begin, method.end - method.begin);
+  request.target = std::string_view(data + target.begin, target.end - target.begin);
+  request.version = std::string_view(data + version.begin, version.end - version.begin);
+  request.headerCount = headerCount;
+  for(size_t i = 0; i < headerCount; ++i) {
+    request.headers[i].name = std::string_view(data + names[i].begin, names[i].end - names[i].begin);
+    request.headers[i].value = std::string_view(data + values[i].begin, values[i].end - values[i].begin);
+  }
+  request.headerLength = pos;
+
+  bool http11 = request.version == "HTTP/1.1";
+  if(!http11 && request.version != "HTTP/1.0") {
+    return fail(505);
+  }
+
+  request.contentLength = 0;
+  request.chunked = false;
+  bool haveLength = false;
+  std::string_view connection;
+  for(size_t i = 0; i < headerCount; ++i) {
+    const HttpHeader& h = request.headers[i];
+    if(equalsIgnoreCase(h.name, "Content-Length")) {
+      size_t length;
+      if(!parseLength(h.value, length) || (haveLength && length != request.contentLength)) {
+        return fail(400);
+      }
+      request.contentLength = length;
+      haveLength = true;
+    }
+    else if(equalsIgnoreCase(h.name, "Transfer-Encoding")) {
+      if(!equalsIgnoreCase(h.value, "chunked")) {
+        return fail(501);
+      }
+      request.chunked = true;
+    }
+    else if(equalsIgnoreCase(h.name, "Connection")) {
+      connection = h.value;
+    }
+  }
+
+  // A request with both framings is ambiguous (request smuggling); refuse it
+  if(haveLength && request.chunked) {
+    return fail(400);
+  }
+
+  // HTTP/1.1 keeps connections open unless told otherwise; HTTP/1.0 only on request
+  request.keepAlive = http11 ? !equalsIgnoreCase(connection, "close")
+                             : equalsIgnoreCase(connection, "keep-alive");
+  return Complete;
+}
@@ -0,0 +1,83 @@
+#ifndef HTTP_PARSER_HPP
+#define HTTP_PARSER_HPP
+
+#include <cstddef>
+#include <string_view>
+
+// Most header fields a request may carry before it is rejected with 431
+const size_t kMaxRequestHeaders = 64;
+
+// Largest header block accepted before answering 431 and closing
+const size_t kMaxHeaderBytes = 64 * 1024;
+
+struct HttpHeader {
+  std::string_view name;
+  std::string_view value;
+};
+
+// A parsed request head. Every field is a view into the caller's receive
+// buffer, so it is only valid until that buffer is modified.
+struct HttpRequest {
+  std::string_view method;
+  std::string_view target;
+  std::string_view version;
+  HttpHeader headers[kMaxRequestHeaders];
+  size_t headerCount = 0;
+
+  size_t headerLength = 0;    // request line + headers + blank line, in bytes
+  size_t contentLength = 0;   // from Content-Length (0 when absent)
+  bool chunked = false;       // Transfer-Encoding: chunked
+  bool keepAlive = true;      // connection persists after this request
+
+  // Case-insensitive header lookup; empty view when absent
+  std::string_view header(std::string_view name) const;
+};
+
+// Incremental, allocation-free parser for an HTTP/1.x request head. Feed it the
+// bytes received so far (always starting at the first byte of the request); it
+// remembers how far it got and only scans the new bytes on the next call, so a
+// request that arrives in fragments is parsed exactly once. Token positions are
+// kept as offsets, which stay valid when the caller's buffer is reallocated.
+class HttpParser {
+  public:
+    enum Status { Incomplete, Complete, Error };
+
+  private:
+    enum State {
+      Method, Target, Version, RequestLineEnd,
+      HeaderStart, HeaderName, HeaderValueStart, HeaderValue,
+      HeadEnd, Done
+    };
+
+    struct Span {
+      size_t begin;
+      size_t end;
+    };
+
+    State state;
+    size_t pos;
+    Span method, target, version;
+    Span names[kMaxRequestHeaders];
+    Span values[kMaxRequestHeaders];
+    size_t headerCount;
+    int errorStatus;
+
+    Status fail(int status);
+
+  public:
+    HttpParser();
+
+    // Continue parsing data[0, len). On Complete, request is filled in with views into data.
+    Status parse(const char* data, size_t len, HttpRequest& request);
+
+    // Forget the current request so the parser can start on the next one
+    void reset();
+
+    // Whether parse() already returned Complete for the current request (its body may still be arriving)
+    bool headParsed() const { return state == Done; }
+
+    // HTTP status to answer with after Error (400, 431, 501 ...)
+    int error() const { return errorStatus; }
+};
+
+#endif // HTTP_PARSER_HPP
@@ -0,0 +1,273 @@
+#include <iostream>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include "lifecycle.hpp"
+#include "server.hpp"
+
+extern char** environ;
+
+// How a restarted process learns about the sockets it inherits
+static const char* const kListenFdsVar = "HTTP_SERVER_LISTEN_FDS";
+static const char* const kReadyFdVar = "HTTP_SERVER_READY_FD";
+
+// How long a restart waits for the new process before giving up on it
+static const int kReadyTimeoutMs = 30000;
+
+Lifecycle::Lifecycle() : drainFlag(false), drainTimeout(0), readyFd(-1) {
+  drainEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(drainEvent < 0) {
+    throw std::runtime_error(std::string("eventfd failed: ") + strerror(errno));
+  }
+}
+
+void Lifecycle::start(int argc, char** argv, const ServerConfig& config) {
+  drainTimeout = std::chrono::seconds(config.drainTimeout);
+
+  // Restart runs whatever binary is at this path by then, so a deploy can replace it
+  char path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  executable = length > 0 ? std::string(path, length) : std::string(argv[0]);
+  args.assign(argv, argv + argc);
+
+  // Sockets are handed over as a comma-separated list of descriptor numbers
+  if(const char* fds = getenv(kListenFdsVar)) {
+    for(const char* p = fds; *p;) {
+      char* end;
+      long fd = strtol(p, &end, 10);
+      if(end == p) {
+        break;
+      }
+      if(fcntl(fd, F_SETFD, FD_CLOEXEC) == 0) {
+        inherited.push_back(static_cast<int>(fd));
+      }
+      p = *end == ',' ? end + 1 : end;
+    }
+  }
+  if(const char* fd = getenv(kReadyFdVar)) {
+    readyFd = atoi(fd);
+    fcntl(readyFd, F_SETFD, FD_CLOEXEC);
+  }
+
+  // Writes to a closed connection fail with EPIPE instead of killing the process
+  signal(SIGPIPE, SIG_IGN);
+
+  // The signals are only ever delivered to the thread waiting for them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread(&Lifecycle::signalLoop, this, signals).detach();
+}
+
+void Lifecycle::signalLoop(sigset_t signals) {
+  while(true) {
+    int sig;
+    if(sigwait(&signals, &sig) != 0) {
+      continue;
+    }
+
+    if(sig == SIGHUP) {
+      if(draining()) {
+        continue;
+      }
+      std::cout << "Restarting: starting a new server process\n";
+      if(restart()) {
+        std::cout << "New server process is serving; draining connections\n";
+        beginDrain();
+      }
+      else {
+        std::cerr << "Restart failed; still serving\n";
+      }
+      continue;
+    }
+
+    if(draining()) {
+      std::cerr << "Stopping without waiting for connections\n";
+      _exit(1);
+    }
+    std::cout << "Shutting down: draining connections for up to " << drainTimeout.count() << "s\n";
+    beginDrain();
+  }
+}
+
+bool Lifecycle::restart() {
+  std::vector<int> fds;
+  {
+    std::lock_guard<std::mutex> lock(listenerMutex);
+    fds = listeners;
+  }
+  if(fds.empty()) {
+    return false;
+  }
+
+  int ready[2];
+  if(pipe2(ready, O_CLOEXEC) != 0) {
+    return false;
+  }
+
+  // Everything the child needs is built here: between fork() and exec() it may only
+  // make async-signal-safe calls, since other threads held locks when it was forked
+  std::string fdList;
+  for(int fd : fds) {
+    fdList += (fdList.empty() ? "" : ",") + std::to_string(fd);
+  }
+  std::vector<std::string> env;
+  for(char** var = environ; *var; ++var) {
+    if(strncmp(*var, kListenFdsVar, strlen(kListenFdsVar)) != 0 && strncmp(*var, kReadyFdVar, strlen(kReadyFdVar)) != 0) {
+      env.push_back(*var);
+    }
+  }
+  env.push_back(std::string(kListenFdsVar) + "=" + fdList);
+  env.push_back(std::string(kReadyFdVar) + "=" + std::to_string(ready[1]));
+
+  std::vector<char*> argvp, envp;
+  for(std::string& arg : args) {
+    argvp.push_back(&arg[0]);
+  }
+  argvp.push_back(nullptr);
+  for(std::string& var : env) {
+    envp.push_back(&var[0]);
+  }
+  envp.push_back(nullptr);
+
+  pid_t pid = fork();
+  if(pid == 0) {
+    for(int fd : fds) {
+      fcntl(fd, F_SETFD, 0);
+    }
+    fcntl(ready[1], F_SETFD, 0);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    execve(executable.c_str(), argvp.data(), envp.data());
+    _exit(127);
+  }
+  close(ready[1]);
+  if(pid < 0) {
+    close(ready[0]);
+    return false;
+  }
+
+  // The child writes one byte once it is serving; EOF means it exited first
+  struct pollfd wait{ready[0], POLLIN, 0};
+  char byte;
+  int rc;
+  while((rc = poll(&wait, 1, kReadyTimeoutMs)) < 0 && errno == EINTR) {
+  }
+  bool ok = rc == 1 && read(ready[0], &byte, 1) == 1;
+  close(ready[0]);
+  if(!ok) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  return ok;
+}
+
+int Lifecycle::openListener(int port, int backlog) {
+  std::lock_guard<std::mutex> lock(listenerMutex);
+  while(!inherited.empty()) {
+    int fd = inherited.front();
+    inherited.erase(inherited.begin());
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    if(getsockname(fd, (struct sockaddr*)&addr, &addrLength) == 0 && addr.sin_family == AF_INET &&
+       ntohs(addr.sin_port) == port) {
+      listeners.push_back(fd);
+      return fd;
+    }
+    close(fd);  // not a socket for this port; the options must have changed
+  }
+
+  int fd = createListeningSocket(port, backlog);
+  if(fd >= 0) {
+    listeners.push_back(fd);
+  }
+  return fd;
+}
+
+void Lifecycle::closeListener(int fd) {
+  std::lock_guard<std::mutex> lock(listenerMutex);
+  for(size_t i = 0; i < listeners.size(); ++i) {
+    if(listeners[i] == fd) {
+      listeners.erase(listeners.begin() + i);
+      close(fd);
+      return;
+    }
+  }
+}
+
+void Lifecycle::serving() {
+  std::lock_guard<std::mutex> lock(listenerMutex);
+  for(int fd : inherited) {
+    close(fd);
+  }
+  inherited.clear();
+  if(readyFd >= 0) {
+    char byte = 1;
+    ssize_t ignored = write(readyFd, &byte, 1);
+    (void)ignored;
+    close(readyFd);
+    readyFd = -1;
+  }
+}
+
+void Lifecycle::beginDrain() {
+  std::lock_guard<std::mutex> lock(drainMutex);
+  if(drainFlag.load(std::memory_order_relaxed)) {
+    return;
+  }
+  deadline = Clock::now() + drainTimeout;
+  drainFlag.store(true, std::memory_order_release);
+  uint64_t one = 1;
+  ssize_t ignored = write(drainEvent, &one, sizeof(one));
+  (void)ignored;
+}
+
+void Lifecycle::handlerStarted(int fd) {
+  std::lock_guard<std::mutex> lock(handlerMutex);
+  handlerFds.insert(fd);
+}
+
+void Lifecycle::handlerFinished(int fd) {
+  std::lock_guard<std::mutex> lock(handlerMutex);
+  handlerFds.erase(fd);
+  if(handlerFds.empty()) {
+    handlersDone.notify_all();
+  }
+}
+
+void Lifecycle::waitForHandlers() {
+  std::unique_lock<std::mutex> lock(handlerMutex);
+  if(handlersDone.wait_until(lock, deadline, [this]() { return handlerFds.empty(); })) {
+    return;
+  }
+  // Out of time: blocked reads and writes fail, and each thread closes its own socket
+  for(int fd : handlerFds) {
+    shutdown(fd, SHUT_RDWR);
+  }
+  handlersDone.wait(lock, [this]() { return handlerFds.empty(); });
+}
+
+bool clientIdle(int fd) {
+  char byte;
+  ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+Lifecycle& lifecycle() {
+  static Lifecycle instance;
+  return instance;
+}
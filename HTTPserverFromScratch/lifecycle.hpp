@@ -0,0 +1,103 @@
+#ifndef LIFECYCLE_HPP
+#define LIFECYCLE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+#include <condition_variable>
+#include <signal.h>
+#include "config.hpp"
+
+// Process-wide shutdown and restart state.
+//
+// SIGTERM or SIGINT starts a graceful shutdown. Listening sockets are closed, so new
+// connections go elsewhere. Idle keep-alive connections are closed (see kDrainGrace). Every response
+// sent from then on carries "Connection: close", so busy connections end once their
+// current request is answered. Whatever is still open at the drain deadline is closed,
+// then the process exits. A second SIGTERM/SIGINT exits at once.
+//
+// SIGHUP restarts without dropping connections. The binary is started again with the
+// same arguments and inherits the listening sockets. Once the new process reports that
+// it is serving, this one drains as above. The sockets themselves are never closed, so
+// connections waiting in the accept queue are picked up by the new process instead of
+// being reset.
+class Lifecycle {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+  private:
+    int drainEvent;                  // eventfd, written once when draining begins and never read
+    std::atomic<bool> drainFlag;
+    std::mutex drainMutex;
+    Clock::time_point deadline;      // written before drainFlag is set
+    std::chrono::seconds drainTimeout;
+
+    std::string executable;          // what a restart runs, resolved at startup
+    std::vector<std::string> args;
+
+    std::mutex listenerMutex;
+    std::vector<int> listeners;      // open listening sockets; a restart hands them over
+    std::vector<int> inherited;      // handed over by the previous process, not yet taken
+    int readyFd;                     // tells the previous process we are serving; -1 if none
+
+    std::mutex handlerMutex;
+    std::condition_variable handlersDone;
+    std::unordered_set<int> handlerFds;  // thread-per-connection sockets still being served
+
+    void signalLoop(sigset_t signals);
+    bool restart();
+
+  public:
+    Lifecycle();
+
+    // Call before any other thread starts, so they all inherit the signal mask. Blocks
+    // the shutdown and restart signals, ignores SIGPIPE, picks up the sockets handed over
+    // by a previous process and starts the thread that waits for the signals.
+    void start(int argc, char** argv, const ServerConfig& config);
+
+    // A listening socket for port: one handed over by the previous process if there is
+    // one, else a new one from createListeningSocket(). Returns -1 on failure.
+    int openListener(int port, int backlog);
+
+    // Close a socket from openListener(); it is no longer handed over on restart
+    void closeListener(int fd);
+
+    // Every listener is open and its worker running. Tells the process that started this
+    // one (if any) to begin draining, and closes handed-over sockets nobody took.
+    void serving();
+
+    // Stop accepting and drain; later calls do nothing. Safe to call from any thread.
+    void beginDrain();
+
+    bool draining() const { return drainFlag.load(std::memory_order_acquire); }
+
+    // Becomes readable (and stays readable) once draining begins, for poll/epoll/io_uring
+    int drainFd() const { return drainEvent; }
+
+    // When connections still open are closed; only meaningful once draining()
+    Clock::time_point drainDeadline() const { return deadline; }
+
+    // Thread-per-connection mode: a handler thread is serving fd / has finished with it
+    void handlerStarted(int fd);
+    void handlerFinished(int fd);
+
+    // Wait for every handler thread until the drain deadline, then shut down the
+    // sockets of those left and wait for them to notice
+    void waitForHandlers();
+};
+
+// How long a connection with nothing in progress must have been quiet before draining
+// closes it, so a client that is just sending its next request does not have it reset
+const std::chrono::milliseconds kDrainGrace(1000);
+
+// Process-wide lifecycle, set up by start() in main
+Lifecycle& lifecycle();
+
+// Whether no request bytes are waiting unread on a client socket. Closing a socket
+// with unread data sends a reset, so draining only closes connections for which this holds.
+bool clientIdle(int fd);
+
+#endif // LIFECYCLE_HPP
@@ -1,65 +1,102 @@
 #include "server.hpp"
+#include "config.hpp"
+#include "event_loop.hpp"
+#include "uring_loop.hpp"
+#include "response_cache.hpp"
+#include "gzip_cache.hpp"
+#include "upload.hpp"
+#include "metrics.hpp"
+#include "access_log.hpp"
+#include "lifecycle.hpp"
+#include "admission.hpp"
 #include <iostream>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <thread>
+#include <functional>
 
 int main(int argc, char** argv) {
 
-    // Create a Socket for the server to listen for incoming connections
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if(server_fd < 0) {
-        std::cerr << "Failed to create server socket\n";
+    ServerConfig config;
+    if(!parseArgs(argc, argv, config)) {
         return 1;
     }
 
-    // Enable reuse of the port to avoid "Address already in use" errors
-    int reuse = 1;
-    if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
-        std::cerr << "setsockopt failed\n";
+    // Before any thread starts: signal handling, and sockets handed over by a restart
+    lifecycle().start(argc, argv, config);
+
+    registerDefaultRoutes();
+    responseCache().configure(config.cacheBytes, config.cacheMaxEntry);
+    gzipCache().configure(config.gzipCacheBytes, config.gzipMaxFile, config.gzipLevel);
+    admission().configure(config.maxConnections, config.clientRate, config.clientBurst);
+    if(!uploadStore().configure(config.uploadDir, config.maxUpload)) {
+        return 1;
+    }
+    if(!config.accessLog.empty() && !accessLog().open(config.accessLog)) {
         return 1;
     }
 
-    // Define the server address structure
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(4221);
+    // io_uring mode: every worker has its own ring and SO_REUSEPORT socket
+    if(config.io == "uring") {
+        return runUringServer(config);
+    }
 
-    // Bind the server socket to the specified address and port
-    if(bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
-        std::cerr << "Failed to bind to port 4221\n";
-        return 1;
+    // Sharded mode: every listener thread binds its own SO_REUSEPORT socket
+    if(config.listeners > 0) {
+        return runReuseportServer(config);
     }
 
-    // Listen for incoming connections on the server socket
-    int connection_backlog = 5;
-    if(listen(server_fd, connection_backlog) != 0) {
-        std::cerr << "Listening failed\n";
+    // Create, bind and listen on the server socket, or take over the previous process's
+    int server_fd = lifecycle().openListener(config.port, config.backlog);
+    if(server_fd < 0) {
         return 1;
     }
 
-    // Accept incoming connections from clients
+    // Event loop mode: a fixed pool of epoll workers owns every connection
+    if(config.io == "epoll") {
+        return runEpollServer(server_fd, config);
+    }
+
+    // Accept incoming connections from clients until a shutdown or restart begins
     struct sockaddr_in client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
     std::cout << "Waiting for clients to connect...\n";
+    lifecycle().serving();
 
+    // Non-blocking, so losing a connection to another process sharing the socket (during
+    // a restart) returns to poll() instead of blocking in accept(); clients still block
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL, 0) | O_NONBLOCK);
+    struct pollfd fds[2] = {{server_fd, POLLIN, 0}, {lifecycle().drainFd(), POLLIN, 0}};
     while(true) {
+        if(poll(fds, 2, -1) < 0) {
+            continue;  // EINTR
+        }
+        if(fds[1].revents) {
+            break;
+        }
         int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_addr_len);
         if(client_fd != -1) {
-            std::cout << "Client connected\n";
-            std::thread(handleConnection, client_fd).detach();
+            // Over the connection cap or the client's rate: answered and closed, no thread
+            if(!admitConnection(client_fd, &client_addr)) {
+                continue;
+            }
+            lifecycle().handlerStarted(client_fd);
+            std::thread(handleConnection, client_fd, std::cref(config), monotonicNanos()).detach();
         }
-        else {
+        else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
             std::cerr << "Failed to accept client connection\n";
         }
     }
 
-    // Close server socket
-    close(server_fd);
+    // Close server socket, then let the handler threads finish
+    lifecycle().closeListener(server_fd);
+    lifecycle().waitForHandlers();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,265 @@
+#include <chrono>
+#include <cstdio>
+#include "metrics.hpp"
+#include "response_cache.hpp"
+#include "gzip_cache.hpp"
+#include "access_log.hpp"
+#include "router.hpp"
+#include "admission.hpp"
+
+uint64_t monotonicNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Bump a counter that only the calling thread writes
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+LatencyHistogram::LatencyHistogram() : count(0), sum(0) {
+  for(std::atomic<uint64_t>& bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+int LatencyHistogram::bucketIndex(uint64_t nanos) {
+  // Values below 32 get a bucket each; above that the top five bits pick the bucket
+  int msb = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+  int magnitude = msb > kSubBucketBits ? msb - kSubBucketBits : 0;
+  if(magnitude > kMaxMagnitude) {
+    return kBuckets - 1;
+  }
+  return (magnitude << kSubBucketBits) + static_cast<int>(nanos >> magnitude);
+}
+
+uint64_t LatencyHistogram::bucketStart(int index) {
+  if(index < (2 << kSubBucketBits)) {
+    return index;
+  }
+  int magnitude = (index >> kSubBucketBits) - 1;
+  return static_cast<uint64_t>(index - (magnitude << kSubBucketBits)) << magnitude;
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+  bump(buckets[bucketIndex(nanos)]);
+  bump(count);
+  bump(sum, nanos);
+}
+
+void LatencyHistogram::addTo(uint64_t* totals, uint64_t& totalCount, uint64_t& totalSum) const {
+  for(int i = 0; i < kBuckets; ++i) {
+    totals[i] += buckets[i].load(std::memory_order_relaxed);
+  }
+  totalCount += count.load(std::memory_order_relaxed);
+  totalSum += sum.load(std::memory_order_relaxed);
+}
+
+// Hands a block back to the registry when its thread exits
+struct MetricsLease {
+  Metrics& owner;
+  ThreadMetrics* block;
+
+  explicit MetricsLease(Metrics& owner) : owner(owner), block(owner.acquire()) {}
+  ~MetricsLease() { owner.release(block); }
+};
+
+ThreadMetrics* Metrics::acquire() {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  if(!freeBlocks.empty()) {
+    ThreadMetrics* block = freeBlocks.back();
+    freeBlocks.pop_back();
+    return block;
+  }
+  blocks.emplace_back(new ThreadMetrics());
+  return blocks.back().get();
+}
+
+void Metrics::release(ThreadMetrics* block) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  freeBlocks.push_back(block);
+}
+
+ThreadMetrics& Metrics::local() {
+  thread_local MetricsLease lease(*this);
+  return *lease.block;
+}
+
+void Metrics::recordPhase(Phase phase, uint64_t startNanos) {
+  local().phases[phase].record(monotonicNanos() - startNanos);
+}
+
+void Metrics::connectionOpened(uint64_t acceptedNanos) {
+  ThreadMetrics& m = local();
+  bump(m.connections);
+  m.phases[PhaseAccept].record(monotonicNanos() - acceptedNanos);
+}
+
+void Metrics::connectionClosed() {
+  bump(local().closed);
+}
+
+void Metrics::requestParsed() {
+  bump(local().requests);
+}
+
+void Metrics::routeHandled(size_t route, uint64_t startNanos) {
+  local().routes[route].record(monotonicNanos() - startNanos);
+}
+
+void Metrics::responseSent(char status, size_t bytes, uint64_t startNanos) {
+  ThreadMetrics& m = local();
+  int statusClass = status >= '1' && status <= '5' ? status - '0' : 0;
+  bump(m.responses[statusClass]);
+  bump(m.bytesSent, bytes);
+  m.phases[PhaseSend].record(monotonicNanos() - startNanos);
+}
+
+static void appendMetric(std::pmr::string& out, const char* name, const char* labels, double value) {
+  char line[256];
+  int n = snprintf(line, sizeof(line), "%s%s %.9g\n", name, labels, value);
+  out.append(line, n);
+}
+
+static void appendMetric(std::pmr::string& out, const char* name, const char* labels, uint64_t value) {
+  char line[256];
+  int n = snprintf(line, sizeof(line), "%s%s %llu\n", name, labels, static_cast<unsigned long long>(value));
+  out.append(line, n);
+}
+
+static void appendHeader(std::pmr::string& out, const char* name, const char* type, const char* help) {
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+// One summary: quantiles read off the merged histogram (the end of the bucket holding
+// the rank), then _sum and _count. labels is the label list without braces.
+static void appendSummary(std::pmr::string& out, const char* name, const char* labels,
+                          const uint64_t* buckets, uint64_t count, uint64_t sum) {
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  char fullName[96];
+  char fullLabels[192];
+  for(double q : quantiles) {
+    uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+    uint64_t seen = 0;
+    double value = 0;
+    for(int i = 0; i < LatencyHistogram::kBuckets && count > 0; ++i) {
+      seen += buckets[i];
+      if(seen >= rank && seen > 0) {
+        value = LatencyHistogram::bucketStart(i + 1) * 1e-9;
+        break;
+      }
+    }
+    snprintf(fullLabels, sizeof(fullLabels), "{%s,quantile=\"%g\"}", labels, q);
+    appendMetric(out, name, fullLabels, value);
+  }
+  snprintf(fullLabels, sizeof(fullLabels), "{%s}", labels);
+  snprintf(fullName, sizeof(fullName), "%s_sum", name);
+  appendMetric(out, fullName, fullLabels, sum * 1e-9);
+  snprintf(fullName, sizeof(fullName), "%s_count", name);
+  appendMetric(out, fullName, fullLabels, count);
+}
+
+void Metrics::render(std::pmr::string& out) {
+  static const char* const phaseNames[PhaseCount] = { "accept", "parse", "handler", "send" };
+
+  uint64_t connections = 0, closed = 0, requests = 0, bytesSent = 0;
+  uint64_t responses[6] = {};
+  std::vector<uint64_t> buckets(PhaseCount * LatencyHistogram::kBuckets);
+  uint64_t phaseCount[PhaseCount] = {};
+  uint64_t phaseSum[PhaseCount] = {};
+  size_t routeCount = router().size();
+  std::vector<uint64_t> routeBuckets(routeCount * LatencyHistogram::kBuckets);
+  std::vector<uint64_t> routeTotal(routeCount), routeSum(routeCount);
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(const std::unique_ptr<ThreadMetrics>& block : blocks) {
+      connections += block->connections.load(std::memory_order_relaxed);
+      closed += block->closed.load(std::memory_order_relaxed);
+      requests += block->requests.load(std::memory_order_relaxed);
+      bytesSent += block->bytesSent.load(std::memory_order_relaxed);
+      for(int i = 0; i < 6; ++i) {
+        responses[i] += block->responses[i].load(std::memory_order_relaxed);
+      }
+      for(int p = 0; p < PhaseCount; ++p) {
+        block->phases[p].addTo(&buckets[p * LatencyHistogram::kBuckets], phaseCount[p], phaseSum[p]);
+      }
+      for(size_t r = 0; r < routeCount; ++r) {
+        block->routes[r].addTo(&routeBuckets[r * LatencyHistogram::kBuckets], routeTotal[r], routeSum[r]);
+      }
+    }
+  }
+
+  appendHeader(out, "http_connections_total", "counter", "Connections accepted.");
+  appendMetric(out, "http_connections_total", "", connections);
+  appendHeader(out, "http_connections_active", "gauge", "Connections currently open.");
+  appendMetric(out, "http_connections_active", "", connections - closed);
+  Admission::Stats admitted = admission().stats();
+  appendHeader(out, "http_connections_rejected_total", "counter", "Connections turned away at accept, by reason.");
+  appendMetric(out, "http_connections_rejected_total", "{reason=\"capacity\"}", admitted.rejectedCapacity);
+  appendMetric(out, "http_connections_rejected_total", "{reason=\"rate\"}", admitted.rejectedRate);
+  appendHeader(out, "http_requests_total", "counter", "Request heads parsed.");
+  appendMetric(out, "http_requests_total", "", requests);
+
+  appendHeader(out, "http_responses_total", "counter", "Responses completely sent, by status class.");
+  static const char* const classLabels[6] = {
+    "{code=\"other\"}", "{code=\"1xx\"}", "{code=\"2xx\"}", "{code=\"3xx\"}", "{code=\"4xx\"}", "{code=\"5xx\"}"
+  };
+  for(int i = 1; i < 6; ++i) {
+    appendMetric(out, "http_responses_total", classLabels[i], responses[i]);
+  }
+  if(responses[0] > 0) {
+    appendMetric(out, "http_responses_total", classLabels[0], responses[0]);
+  }
+  appendHeader(out, "http_response_bytes_total", "counter", "Response bytes written, headers included.");
+  appendMetric(out, "http_response_bytes_total", "", bytesSent);
+
+  appendHeader(out, "http_phase_duration_seconds", "summary", "Time spent in each phase of request handling.");
+  char labels[64];
+  for(int p = 0; p < PhaseCount; ++p) {
+    snprintf(labels, sizeof(labels), "phase=\"%s\"", phaseNames[p]);
+    appendSummary(out, "http_phase_duration_seconds", labels, &buckets[p * LatencyHistogram::kBuckets],
+                  phaseCount[p], phaseSum[p]);
+  }
+
+  // Labelled from the same table whose indices select the histograms
+  if(routeCount > 0) {
+    appendHeader(out, "http_route_duration_seconds", "summary", "Time spent in the handler, by route.");
+    std::string routeLabel;
+    for(size_t r = 0; r < routeCount; ++r) {
+      routeLabel.assign("route=\"").append(router().route(r).label).append("\"");
+      appendSummary(out, "http_route_duration_seconds", routeLabel.c_str(), &routeBuckets[r * LatencyHistogram::kBuckets],
+                    routeTotal[r], routeSum[r]);
+    }
+  }
+
+  if(accessLog().isEnabled()) {
+    appendHeader(out, "http_access_log_dropped_total", "counter", "Access log lines dropped because the writer fell behind.");
+    appendMetric(out, "http_access_log_dropped_total", "", accessLog().dropped());
+  }
+
+  ResponseCache::Stats cache = responseCache().stats();
+  appendHeader(out, "http_response_cache_hits_total", "counter", "Response cache hits.");
+  appendMetric(out, "http_response_cache_hits_total", "", cache.hits);
+  appendHeader(out, "http_response_cache_misses_total", "counter", "Response cache misses.");
+  appendMetric(out, "http_response_cache_misses_total", "", cache.misses);
+  appendHeader(out, "http_response_cache_bytes", "gauge", "Bytes held by the response cache.");
+  appendMetric(out, "http_response_cache_bytes", "", cache.bytes);
+  appendHeader(out, "http_response_cache_entries", "gauge", "Responses held by the response cache.");
+  appendMetric(out, "http_response_cache_entries", "", cache.entries);
+
+  GzipCache::Stats gzip = gzipCache().stats();
+  appendHeader(out, "http_gzip_cache_hits_total", "counter", "Compressed variant cache hits.");
+  appendMetric(out, "http_gzip_cache_hits_total", "", gzip.hits);
+  appendHeader(out, "http_gzip_cache_misses_total", "counter", "Compressed variant cache misses.");
+  appendMetric(out, "http_gzip_cache_misses_total", "", gzip.misses);
+  appendHeader(out, "http_gzip_compressions_total", "counter", "Files compressed with deflate.");
+  appendMetric(out, "http_gzip_compressions_total", "", gzip.compressions);
+  appendHeader(out, "http_gzip_cache_bytes", "gauge", "Bytes held by the compressed variant cache.");
+  appendMetric(out, "http_gzip_cache_bytes", "", gzip.bytes);
+}
+
+Metrics& metrics() {
+  static Metrics instance;
+  return instance;
+}
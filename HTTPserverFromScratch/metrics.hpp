@@ -0,0 +1,103 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <memory_resource>
+
+// Request phases with their own latency histogram
+enum Phase {
+  PhaseAccept,   // accept() returning until the connection is registered with the thread serving it
+  PhaseParse,    // parsing a request head (the final parse() call when it arrives in pieces)
+  PhaseHandler,  // building the response
+  PhaseSend,     // first write attempt of a response until its last byte is handed to the kernel
+  PhaseCount
+};
+
+// Most routes in the route table; each has its own handler latency histogram
+const size_t kMaxRoutes = 16;
+
+// Nanoseconds on the monotonic clock
+uint64_t monotonicNanos();
+
+// Log-linear latency histogram in nanoseconds, in the style of HdrHistogram: every
+// power of two is split into 16 sub-buckets, so any recorded value is known to within
+// about 6%. Recording is a couple of shifts and one counter update.
+//
+// Only the owning thread records, so counters are bumped with a relaxed load and
+// store rather than a locked read-modify-write; readers on other threads may see a
+// snapshot that is a few updates old, never a torn value.
+class LatencyHistogram {
+  public:
+    static const int kSubBucketBits = 4;
+    static const int kMaxMagnitude = 36;  // values from 2^41 ns (about 37 minutes) up land in the last bucket
+    static const int kBuckets = (kMaxMagnitude + 2) << kSubBucketBits;
+
+  private:
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+  public:
+    LatencyHistogram();
+
+    void record(uint64_t nanos);
+
+    // Smallest value that falls in bucket `index`
+    static uint64_t bucketStart(int index);
+    static int bucketIndex(uint64_t nanos);
+
+    // Add this histogram's counts into a plain array of kBuckets entries
+    void addTo(uint64_t* totals, uint64_t& totalCount, uint64_t& totalSum) const;
+};
+
+// Counters and histograms written by one thread only
+struct ThreadMetrics {
+  LatencyHistogram phases[PhaseCount];
+  LatencyHistogram routes[kMaxRoutes];  // handler time, by Route::index
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> closed{0};
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> responses[6] = {};  // by status class; [0] is anything unrecognised
+  std::atomic<uint64_t> bytesSent{0};
+};
+
+// Process-wide metrics. Each thread gets its own ThreadMetrics block on first use, so
+// the hot path never shares a cache line or takes a lock; the blocks are only summed
+// when somebody asks for /metrics. A thread's block is recycled for the next thread
+// when it exits (thread-per-connection mode), and its counts are kept.
+class Metrics {
+  private:
+    std::mutex registryMutex;  // only taken when a thread starts, exits or /metrics is rendered
+    std::vector<std::unique_ptr<ThreadMetrics>> blocks;
+    std::vector<ThreadMetrics*> freeBlocks;
+
+    friend struct MetricsLease;
+    ThreadMetrics* acquire();
+    void release(ThreadMetrics* block);
+
+  public:
+    // The calling thread's block
+    ThreadMetrics& local();
+
+    void recordPhase(Phase phase, uint64_t startNanos);
+    void connectionOpened(uint64_t acceptedNanos);  // also records PhaseAccept
+    void connectionClosed();
+    void requestParsed();
+    // The handler of route number `route` returned
+    void routeHandled(size_t route, uint64_t startNanos);
+    // A response was completely written; `status` is the first byte of its status code
+    void responseSent(char status, size_t bytes, uint64_t startNanos);
+
+    // Prometheus text exposition format, version 0.0.4
+    void render(std::pmr::string& out);
+};
+
+// Process-wide metrics used by every I/O backend
+Metrics& metrics();
+
+#endif // METRICS_HPP
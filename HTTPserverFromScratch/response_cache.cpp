@@ -0,0 +1,96 @@
+#include <unistd.h>
+#include "response_cache.hpp"
+
+ResponseCache::ResponseCache(size_t budgetBytes, size_t maxEntryBytes)
+    : budgetBytes(budgetBytes), maxEntryBytes(maxEntryBytes), usedBytes(0), hits(0), misses(0) {
+}
+
+void ResponseCache::configure(size_t budget, size_t maxEntry) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budgetBytes = budget;
+  maxEntryBytes = maxEntry;
+  while(usedBytes > budgetBytes && !lru.empty()) {
+    eraseLocked(entries.find(lru.back()));
+  }
+}
+
+void ResponseCache::eraseLocked(std::unordered_map<std::string, Entry>::iterator it) {
+  usedBytes -= it->second.response->size();
+  lru.erase(it->second.lruPos);
+  entries.erase(it);
+}
+
+std::shared_ptr<const std::string> ResponseCache::lookup(const std::string& path, const OpenFile& file) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(path);
+  if(it != entries.end()) {
+    const Entry& entry = it->second;
+    if(entry.inode == file.inode && entry.fileSize == file.size &&
+       entry.mtime.tv_sec == file.mtime.tv_sec && entry.mtime.tv_nsec == file.mtime.tv_nsec) {
+      lru.splice(lru.begin(), lru, entry.lruPos);
+      hits.fetch_add(1, std::memory_order_relaxed);
+      return entry.response;
+    }
+    eraseLocked(it);  // stale: the file changed since it was cached
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+  return nullptr;
+}
+
+std::shared_ptr<const std::string> ResponseCache::fill(const std::string& path, const OpenFile& file,
+                                                       std::string_view extraHeaders) {
+  std::string header = "HTTP/1.1 200 OK\r\n";
+  header.append(extraHeaders);
+  header += "Content-Length: " + std::to_string(file.size) + "\r\n\r\n";
+  auto response = std::make_shared<std::string>();
+  response->reserve(header.size() + file.size);
+  response->append(header);
+  response->resize(header.size() + file.size);
+
+  // pread leaves the shared descriptor's file offset alone
+  size_t done = 0;
+  while(done < file.size) {
+    ssize_t nbytes = pread(file.fd, &(*response)[header.size() + done], file.size - done, done);
+    if(nbytes <= 0) {
+      return nullptr;
+    }
+    done += nbytes;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto existing = entries.find(path);
+  if(existing != entries.end()) {
+    eraseLocked(existing);
+  }
+  if(response->size() > budgetBytes) {
+    return response;
+  }
+  while(usedBytes + response->size() > budgetBytes && !lru.empty()) {
+    eraseLocked(entries.find(lru.back()));
+  }
+
+  Entry entry;
+  entry.response = response;
+  entry.fileSize = file.size;
+  entry.mtime = file.mtime;
+  entry.inode = file.inode;
+  entry.lruPos = lru.insert(lru.begin(), path);
+  usedBytes += response->size();
+  entries.emplace(path, std::move(entry));
+  return response;
+}
+
+ResponseCache::Stats ResponseCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  Stats s;
+  s.hits = hits.load(std::memory_order_relaxed);
+  s.misses = misses.load(std::memory_order_relaxed);
+  s.bytes = usedBytes;
+  s.entries = entries.size();
+  return s;
+}
+
+ResponseCache& responseCache() {
+  static ResponseCache cache;
+  return cache;
+}
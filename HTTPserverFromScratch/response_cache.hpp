@@ -0,0 +1,70 @@
+#ifndef RESPONSE_CACHE_HPP
+#define RESPONSE_CACHE_HPP
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include "file_cache.hpp"
+
+// Bounded LRU cache of complete, ready-to-send GET responses (status line, headers
+// and body) for small files. A hit is served straight from the shared buffer with
+// no formatting and no copy. Entries are keyed by path and remember which version
+// of the file they were built from, so a file that changed on disk is a miss.
+class ResponseCache {
+  public:
+    struct Stats {
+      unsigned long hits;
+      unsigned long misses;
+      size_t bytes;
+      size_t entries;
+    };
+
+  private:
+    struct Entry {
+      std::shared_ptr<const std::string> response;
+      size_t fileSize;
+      struct timespec mtime;
+      ino_t inode;
+      std::list<std::string>::iterator lruPos;
+    };
+
+    std::mutex mutex;
+    size_t budgetBytes;
+    size_t maxEntryBytes;
+    size_t usedBytes;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // most recently used at the front
+
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+
+    void eraseLocked(std::unordered_map<std::string, Entry>::iterator it);
+
+  public:
+    ResponseCache(size_t budgetBytes = 64 * 1024 * 1024, size_t maxEntryBytes = 256 * 1024);
+
+    // Change the limits; entries over the new budget are evicted
+    void configure(size_t budgetBytes, size_t maxEntryBytes);
+
+    // Whether a file of this size is small enough to be cached at all
+    bool eligible(size_t fileSize) const { return budgetBytes > 0 && fileSize <= maxEntryBytes; }
+
+    // The cached response for path if it was built from this version of file, else nullptr
+    std::shared_ptr<const std::string> lookup(const std::string& path, const OpenFile& file);
+
+    // Read file, build the full 200 response (with extraHeaders, each ending in CRLF), cache
+    // it and return it (nullptr on read error)
+    std::shared_ptr<const std::string> fill(const std::string& path, const OpenFile& file,
+                                            std::string_view extraHeaders = std::string_view());
+
+    Stats stats();
+};
+
+// Process-wide cache used by the request handlers
+ResponseCache& responseCache();
+
+#endif // RESPONSE_CACHE_HPP
@@ -0,0 +1,220 @@
+#include "router.hpp"
+
+static const char* const kMethodNames[MethodCount] = {
+  "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH"
+};
+
+HttpMethod parseMethod(std::string_view token) {
+  for(int m = 0; m < MethodCount; ++m) {
+    if(token == kMethodNames[m]) {
+      return static_cast<HttpMethod>(m);
+    }
+  }
+  return MethodCount;
+}
+
+const char* methodName(HttpMethod method) {
+  return kMethodNames[method];
+}
+
+std::string_view RouteParams::get(std::string_view name) const {
+  for(size_t i = 0; i < count; ++i) {
+    if(names[i] == name) {
+      return values[i];
+    }
+  }
+  return std::string_view();
+}
+
+HttpResponse runRoute(const Route& route, const RouteContext& context) {
+  uint64_t start = monotonicNanos();
+  HttpResponse response = route.handler(context);
+  metrics().routeHandled(route.index, start);
+  return response;
+}
+
+// Check that parameters and wildcards take whole, named segments, the wildcard only the
+// last one, and that nothing would break the quoting of a metrics label
+static bool validPattern(std::string_view pattern) {
+  if(pattern.empty() || pattern[0] != '/') {
+    return false;
+  }
+  size_t params = 0;
+  for(size_t i = 0; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    if(c == '"' || c == '\\' || c == '\n') {
+      return false;
+    }
+    if(c != ':' && c != '*') {
+      continue;
+    }
+    size_t end = pattern.find('/', i);
+    std::string_view name = pattern.substr(i + 1, end == std::string_view::npos ? end : end - i - 1);
+    if(pattern[i - 1] != '/' || name.empty() || name.find_first_of(":*") != std::string_view::npos ||
+       (c == '*' && end != std::string_view::npos) || ++params > kMaxRouteParams) {
+      return false;
+    }
+    i += name.size();
+  }
+  return true;
+}
+
+Router::Node* Router::insert(Node* node, std::string_view pattern) {
+  while(!pattern.empty()) {
+    if(pattern[0] == ':') {
+      size_t end = pattern.find('/');
+      std::string_view name = pattern.substr(1, end == std::string_view::npos ? end : end - 1);
+      if(!node->param) {
+        node->param.reset(new Node());
+        node->paramName.assign(name.data(), name.size());
+      }
+      else if(node->paramName != name) {
+        return nullptr;  // "/users/:id" and "/users/:name" cannot both be told apart
+      }
+      node = node->param.get();
+      pattern = end == std::string_view::npos ? std::string_view() : pattern.substr(end);
+      continue;
+    }
+    if(pattern[0] == '*') {
+      std::string_view name = pattern.substr(1);
+      if(!node->wildcard) {
+        node->wildcard.reset(new Node());
+        node->wildcardName.assign(name.data(), name.size());
+      }
+      else if(node->wildcardName != name) {
+        return nullptr;
+      }
+      return node->wildcard.get();
+    }
+
+    // A run of static bytes, up to the next parameter or wildcard
+    std::string_view run = pattern.substr(0, pattern.find_first_of(":*"));
+    size_t slot = node->indices.find(run[0]);
+    if(slot == std::string::npos) {
+      node->indices.push_back(run[0]);
+      node->children.emplace_back(new Node());
+      node = node->children.back().get();
+      node->prefix.assign(run.data(), run.size());
+      pattern.remove_prefix(run.size());
+      continue;
+    }
+
+    Node* child = node->children[slot].get();
+    size_t common = 1;
+    while(common < run.size() && common < child->prefix.size() && run[common] == child->prefix[common]) {
+      ++common;
+    }
+    if(common < child->prefix.size()) {
+      // Split the edge: the shared bytes become a new node above child
+      std::unique_ptr<Node> split(new Node());
+      split->prefix = child->prefix.substr(0, common);
+      child->prefix.erase(0, common);
+      split->indices.push_back(child->prefix[0]);
+      split->children.push_back(std::move(node->children[slot]));
+      node->children[slot] = std::move(split);
+      child = node->children[slot].get();
+    }
+    node = child;
+    pattern.remove_prefix(common);
+  }
+  return node;
+}
+
+bool Router::add(std::string_view method, std::string_view pattern, RouteHandler handler, bool streamsBody) {
+  HttpMethod m = parseMethod(method);
+  if(m == MethodCount || routes.size() >= kMaxRoutes || !validPattern(pattern)) {
+    return false;
+  }
+  Node* node = insert(&roots[m], pattern);
+  if(!node || node->route) {
+    return false;
+  }
+
+  std::unique_ptr<Route> route(new Route());
+  route->method = m;
+  route->pattern.assign(pattern.data(), pattern.size());
+  route->label.assign(kMethodNames[m]).append(" ").append(route->pattern);
+  route->handler = handler;
+  route->streamsBody = streamsBody;
+  route->index = routes.size();
+  node->route = route.get();
+  routes.push_back(std::move(route));
+  return true;
+}
+
+const Router::Node* Router::find(const Node* node, std::string_view path, RouteParams& params) {
+  if(path.empty()) {
+    if(node->route) {
+      return node;
+    }
+    if(node->wildcard && node->wildcard->route && params.count < kMaxRouteParams) {
+      params.names[params.count] = node->wildcardName;
+      params.values[params.count++] = path;
+      return node->wildcard.get();
+    }
+    return nullptr;
+  }
+
+  // Static bytes first, then a parameter, then a wildcard; a dead end falls back to the next
+  size_t slot = node->indices.find(path[0]);
+  if(slot != std::string::npos) {
+    const Node* child = node->children[slot].get();
+    if(path.substr(0, child->prefix.size()) == child->prefix) {
+      const Node* found = find(child, path.substr(child->prefix.size()), params);
+      if(found) {
+        return found;
+      }
+    }
+  }
+
+  if(node->param && params.count < kMaxRouteParams) {
+    size_t end = path.find('/');
+    std::string_view value = path.substr(0, end);
+    if(!value.empty()) {
+      size_t saved = params.count;
+      params.names[params.count] = node->paramName;
+      params.values[params.count++] = value;
+      const Node* found = find(node->param.get(), end == std::string_view::npos ? std::string_view() : path.substr(end), params);
+      if(found) {
+        return found;
+      }
+      params.count = saved;
+    }
+  }
+
+  if(node->wildcard && node->wildcard->route && params.count < kMaxRouteParams) {
+    params.names[params.count] = node->wildcardName;
+    params.values[params.count++] = path;
+    return node->wildcard.get();
+  }
+  return nullptr;
+}
+
+const Route* Router::match(std::string_view method, std::string_view path, RouteParams& params) const {
+  HttpMethod m = parseMethod(method);
+  if(m == MethodCount) {
+    return nullptr;
+  }
+  params.count = 0;
+  const Node* node = find(&roots[m], path, params);
+  return node ? node->route : nullptr;
+}
+
+std::string Router::allowedMethods(std::string_view path) const {
+  std::string allowed;
+  for(int m = 0; m < MethodCount; ++m) {
+    RouteParams params;
+    if(find(&roots[m], path, params)) {
+      if(!allowed.empty()) {
+        allowed.append(", ");
+      }
+      allowed.append(kMethodNames[m]);
+    }
+  }
+  return allowed;
+}
+
+Router& router() {
+  static Router table;
+  return table;
+}
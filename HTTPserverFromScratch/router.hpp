@@ -0,0 +1,111 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include "http_parser.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+
+// Methods the route table knows about
+enum HttpMethod {
+  MethodGet, MethodHead, MethodPost, MethodPut, MethodDelete, MethodOptions, MethodPatch,
+  MethodCount
+};
+
+// The method named by token, or MethodCount if it is not one of the above
+HttpMethod parseMethod(std::string_view token);
+
+// The token for method
+const char* methodName(HttpMethod method);
+
+// Most parameters one route pattern may capture
+const size_t kMaxRouteParams = 8;
+
+// Path parameters captured by a match, as views into the matched path
+struct RouteParams {
+  std::string_view names[kMaxRouteParams];
+  std::string_view values[kMaxRouteParams];
+  size_t count = 0;
+
+  // The value captured for name; empty view when absent
+  std::string_view get(std::string_view name) const;
+};
+
+// Everything a handler is given. For routes that stream their body to disk the request
+// head is gone by the time the body is complete, so only method and target are set.
+struct RouteContext {
+  const HttpRequest& request;
+  const RouteParams& params;
+  std::string_view body;            // in-memory body (Content-Length requests)
+  Upload* upload;                   // streamed body for upload routes, else nullptr
+  std::pmr::memory_resource* arena; // where the response is built
+};
+
+typedef HttpResponse (*RouteHandler)(const RouteContext& context);
+
+// One entry of the route table
+struct Route {
+  HttpMethod method;
+  std::string pattern;
+  std::string label;     // "METHOD pattern", for metrics
+  RouteHandler handler;
+  bool streamsBody;      // the body is handed to the UploadStore as it arrives
+  size_t index;          // position in the table; also selects the route's latency histogram
+};
+
+// Run route's handler, recording its latency under the route
+HttpResponse runRoute(const Route& route, const RouteContext& context);
+
+// Maps a method and a path pattern to a handler. Patterns are made of '/'-separated
+// segments; a segment may be a parameter (":id", one segment) and the last one may be a
+// wildcard ("*path", the rest of the path, possibly empty). Static segments win over
+// parameters, which win over wildcards.
+//
+// Every method has its own compact radix trie: edges carry whole runs of static bytes
+// and a node finds its child by first byte, so a lookup walks the path once and its
+// cost does not depend on how many routes there are. Routes are registered at startup,
+// before any worker runs; after that the table is only read and needs no locking.
+class Router {
+  private:
+    struct Node {
+      std::string prefix;                          // static bytes consumed on the way in
+      std::string indices;                         // first byte of each static child
+      std::vector<std::unique_ptr<Node>> children;
+      std::unique_ptr<Node> param;                 // ":name" child
+      std::string paramName;
+      std::unique_ptr<Node> wildcard;              // "*name" child, always a leaf
+      std::string wildcardName;
+      const Route* route = nullptr;
+    };
+
+    Node roots[MethodCount];
+    std::vector<std::unique_ptr<Route>> routes;
+
+    static Node* insert(Node* node, std::string_view pattern);
+    static const Node* find(const Node* node, std::string_view path, RouteParams& params);
+
+  public:
+    // Register handler for method and pattern. Returns false, registering no route, for
+    // an unknown method, a malformed pattern, one that is already taken or clashes with a
+    // differently named parameter, or a full table (kMaxRoutes).
+    bool add(std::string_view method, std::string_view pattern, RouteHandler handler, bool streamsBody = false);
+
+    // The route for method and path (no query string), with its parameters, or nullptr
+    const Route* match(std::string_view method, std::string_view path, RouteParams& params) const;
+
+    // Comma-separated methods that have a route for path, for the Allow header of a 405;
+    // empty when none does
+    std::string allowedMethods(std::string_view path) const;
+
+    size_t size() const { return routes.size(); }
+    const Route& route(size_t index) const { return *routes[index]; }
+};
+
+// Process-wide route table, filled in by registerDefaultRoutes() at startup
+Router& router();
+
+#endif // ROUTER_HPP
@@ -2,96 +2,682 @@
 #include <cstdlib>
 #include <string>
 #include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <sys/time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <vector>
-#include <sstream>
+#include <charconv>
 #include <thread>
-#include <fstream>
 #include "server.hpp"
+#include "response_cache.hpp"
+#include "metrics.hpp"
+#include "access_log.hpp"
+#include "gzip_cache.hpp"
+#include "http_conditional.hpp"
+#include "router.hpp"
+#include "lifecycle.hpp"
+#include "admission.hpp"
 
-void handleConnection(int client_fd) {
-    char buffer[1024];
+int createListeningSocket(int port, int backlog) {
+  // Create a Socket for the server to listen for incoming connections
+  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(server_fd < 0) {
+    std::cerr << "Failed to create server socket\n";
+    return -1;
+  }
+
+  // SO_REUSEPORT avoids "Address already in use" errors and lets several
+  // sockets share the port, with the kernel balancing connections across them
+  int reuse = 1;
+  if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+    std::cerr << "setsockopt failed\n";
+    close(server_fd);
+    return -1;
+  }
+
+  // Accepted sockets inherit TCP_NODELAY, so pipelined responses are not held back by Nagle
+  setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &reuse, sizeof(reuse));
 
-      // Receive the message
-      ssize_t nbytes = recv(client_fd, buffer, 1024, 0);
-      if(nbytes < 0) {
-        std::cerr << "Failed to recv from client\n";
-        close(client_fd);
-        return;
-      } 
-      
-      std::string request(buffer, nbytes);
-      std::string response = generateHttpResponse(request);
+  // Define the server address structure
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = INADDR_ANY;
+  server_addr.sin_port = htons(port);
+
+  // Bind the server socket to the specified address and port
+  if(bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+    std::cerr << "Failed to bind to port " << port << "\n";
+    close(server_fd);
+    return -1;
+  }
+
+  // Listen for incoming connections on the server socket
+  if(listen(server_fd, backlog) != 0) {
+    std::cerr << "Listening failed\n";
+    close(server_fd);
+    return -1;
+  }
 
-      nbytes = send(client_fd, response.c_str(), response.length(), 0);
-      if(nbytes < 0) {
-        std::cerr << "Failed to send to client\n";
-        close(client_fd);
-        return;
+  return server_fd;
+}
+
+int gatherResponses(const std::deque<HttpResponse>& out, size_t offset, struct iovec* iov, int maxIov) {
+  int count = 0;
+  for(const HttpResponse& response : out) {
+    size_t skip = offset;  // only the front response is partly written
+    offset = 0;
+
+    std::string_view head = response.bytes();
+    if(skip < head.size()) {
+      iov[count].iov_base = const_cast<char*>(head.data() + skip);
+      iov[count].iov_len = head.size() - skip;
+      skip = 0;
+      if(++count == maxIov) {
+        return count;
       }
+    }
+    else {
+      skip -= head.size();
+    }
 
-      close(client_fd);
-      std::cout << "Connection closed\n";
+    for(const ResponseSegment& segment : response.body) {
+      if(skip >= segment.length) {
+        skip -= segment.length;
+        continue;
+      }
+      if(!segment.data) {
+        return count;  // file regions go out with sendfile()
+      }
+      iov[count].iov_base = const_cast<char*>(segment.data + skip);
+      iov[count].iov_len = segment.length - skip;
+      skip = 0;
+      if(++count == maxIov) {
+        return count;
+      }
+    }
+  }
+  return count;
 }
 
-std::vector<std::string> parseRequestHeaders(const std::string& request) {
-  std::stringstream ss(request);
-  std::string line;
-  std::vector<std::string> headers;
+ssize_t sendFileRegion(int client_fd, const HttpResponse& response, size_t offset) {
+  offset -= response.bytes().size();
+  for(const ResponseSegment& segment : response.body) {
+    if(offset < segment.length) {
+      off_t position = segment.fileOffset + offset;
+      return sendfile(client_fd, response.file->fd, &position, segment.length - offset);
+    }
+    offset -= segment.length;
+  }
+  return 0;
+}
+
+void advanceResponses(std::deque<HttpResponse>& out, size_t& offset, size_t written, uint64_t& sendStart, uint64_t now) {
+  while(!out.empty()) {
+    size_t remaining = out.front().size() - offset;
+    if(written < remaining) {
+      offset += written;
+      return;
+    }
+    written -= remaining;
+    recordResponseSent(out.front(), sendStart);
+    out.pop_front();
+    offset = 0;
+    sendStart = now;
+  }
+}
+
+bool writeResponses(int client_fd, std::deque<HttpResponse>& out, size_t& offset, uint64_t& sendStart) {
+  uint64_t now = monotonicNanos();
+  if(offset == 0) {
+    sendStart = now;
+  }
+
+  while(!out.empty()) {
+    struct iovec iov[kMaxWriteIov];
+    int count = gatherResponses(out, offset, iov, kMaxWriteIov);
+    ssize_t nbytes;
+    if(count > 0) {
+      // Headers and in-memory bodies of several pipelined responses in one system call
+      struct msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = count;
+      nbytes = sendmsg(client_fd, &msg, MSG_NOSIGNAL);
+    }
+    else {
+      // A file region, copied by the kernel without passing through user space
+      nbytes = sendFileRegion(client_fd, out.front(), offset);
+      if(nbytes == 0) {
+        return false;  // file shrank underneath us
+      }
+    }
+    if(nbytes < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    advanceResponses(out, offset, nbytes, sendStart, now);
+  }
+  return true;
+}
+
+void handleConnection(int client_fd, const ServerConfig& config, uint64_t accepted_ns) {
+  metrics().connectionOpened(accepted_ns);
+
+  // A client that stalls in the middle of a request makes recv() fail with EAGAIN after the timeout
+  if(config.idleTimeout > 0) {
+    struct timeval tv;
+    tv.tv_sec = config.idleTimeout;
+    tv.tv_usec = 0;
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  char buffer[4096];
+  std::string in;
+  HttpSession session;  // declared before out: queued responses live in its arena
+  std::deque<HttpResponse> out;
+  size_t outOffset = 0;
+  uint64_t sendStart = 0;
+  bool keepAlive = true;
+
+  while(keepAlive) {
+    // Between requests, wait for the client or for draining to begin, whichever is first.
+    // A connection still quiet kDrainGrace into the drain is closed; one with a request in
+    // progress is finished, and its response says "Connection: close".
+    if(in.empty() && !session.upload) {
+      struct pollfd fds[2] = {{client_fd, POLLIN, 0}, {lifecycle().drainFd(), POLLIN, 0}};
+      int ready = poll(fds, 2, config.idleTimeout > 0 ? config.idleTimeout * 1000 : -1);
+      if(ready < 0 && errno == EINTR) {
+        continue;
+      }
+      if(ready > 0 && fds[1].revents && !fds[0].revents) {
+        ready = poll(fds, 1, kDrainGrace.count());
+      }
+      if(ready == 0) {
+        break;  // idle timeout, or quiet while draining
+      }
+    }
+
+    // Receive the next chunk; a request may span several reads and one read may hold several requests
+    ssize_t nbytes = recv(client_fd, buffer, sizeof(buffer), 0);
+    if(nbytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if(nbytes <= 0) {
+      break;  // peer closed, error, or idle timeout
+    }
+
+    in.append(buffer, nbytes);
+    keepAlive = processRequests(session, in, out, config.maxOutput);
 
-  while(std::getline(ss, line) && line != "\r") {
-    headers.push_back(line);
+    // The socket is blocking, so this returns with everything written or on an error.
+    // Requests held back by the output cap are handled once their predecessors are out.
+    bool sendFailed = !writeResponses(client_fd, out, outOffset, sendStart);
+    while(!sendFailed && keepAlive && session.outputFull) {
+      keepAlive = processRequests(session, in, out, config.maxOutput);
+      sendFailed = !writeResponses(client_fd, out, outOffset, sendStart);
+    }
+    if(sendFailed) {
+      std::cerr << "Failed to send to client\n";
+      break;
+    }
   }
 
-  return headers;
+  lifecycle().handlerFinished(client_fd);
+  close(client_fd);
+  metrics().connectionClosed();
+  admission().release();
 }
 
-std::string generateHttpResponse(const std::string& request) {
-  auto headers = parseRequestHeaders(request);
-  if(headers.empty()) {
-    return "HTTP/1.1 400 Bad Request\r\n\r\n";
+// Response for a request that was rejected; the connection is closed after it
+static HttpResponse errorResponse(int status, std::pmr::memory_resource* arena) {
+  const char* reason = "Bad Request";
+  switch(status) {
+    case 413: reason = "Payload Too Large"; break;
+    case 431: reason = "Request Header Fields Too Large"; break;
+    case 500: reason = "Internal Server Error"; break;
+    case 501: reason = "Not Implemented"; break;
+    case 505: reason = "HTTP Version Not Supported"; break;
   }
-  std::istringstream requestLine(headers[0]);
-  std::string method, resource;
-  requestLine >> method >> resource;
+  char code[4];
+  std::to_chars(code, code + sizeof(code), status);
+  HttpResponse response(arena);
+  response.data.append("HTTP/1.1 ").append(code, 3).append(" ").append(reason);
+  response.data.append("\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  return response;
+}
 
-  if(method == "GET") {
-    return handleGetRequest(resource);
+// Mark the last response on a connection that is about to close
+static void addConnectionClose(HttpResponse& response) {
+  if(response.cached) {
+    response.data.assign(response.cached->data(), response.cached->size());  // never modify the shared cache buffer
+    response.cached.reset();
   }
-  else if(method == "POST") {
-    std::string body = request.substr(request.find("\r\n\r\n") + 4);
-    return handlePostRequest(resource, body);
+  response.data.insert(response.data.find("\r\n") + 2, "Connection: close\r\n");
+}
+
+void recordResponseSent(const HttpResponse& response, uint64_t sendStart) {
+  std::string_view bytes = response.bytes();
+  metrics().responseSent(bytes[9], response.size(), sendStart);
+  if(response.logStart != 0) {
+    int status = (bytes[9] - '0') * 100 + (bytes[10] - '0') * 10 + (bytes[11] - '0');
+    accessLog().log(response.logMethod, response.logTarget, status, response.size(), response.logStart);
   }
+}
 
-  return "HTTP/1.1 405 Method Not Allowed\r\n\r\n";
+// Copy s into the arena so it outlives the receive buffer
+static std::string_view arenaCopy(std::string_view s, std::pmr::memory_resource* arena) {
+  if(s.empty()) {
+    return s;
+  }
+  char* copy = static_cast<char*>(arena->allocate(s.size(), 1));
+  memcpy(copy, s.data(), s.size());
+  return std::string_view(copy, s.size());
+}
 
+// Queue a response to a request, tagged for the access log if it is on,
+// and add its in-memory size to `queued`
+static void queueResponse(std::deque<HttpResponse>& out, size_t& queued, HttpResponse response, std::string_view method,
+                          std::string_view target, uint64_t start, std::pmr::memory_resource* arena) {
+  if(accessLog().isEnabled()) {
+    response.logMethod = arenaCopy(method, arena);
+    response.logTarget = arenaCopy(target, arena);
+    response.logStart = start;
+  }
+  queued += response.memoryBytes();
+  out.push_back(std::move(response));
 }
 
-std::string handleGetRequest(const std::string& resource) {
-  std::string filename = (resource == "/" ? "index.html" : resource.substr(1));
-  std::ifstream file(filename);
+bool processRequests(HttpSession& session, std::string& in, std::deque<HttpResponse>& out, size_t outputLimit) {
+  size_t consumed = 0;
+  bool keepAlive = true;
+  HttpRequest request;
 
-  if(!file) {
-    return "HTTP/1.1 404 Not Found\r\n\r\n";
+  // Everything the previous batch built has been sent, so its memory can be reused
+  if(out.empty()) {
+    session.arena.reset();
+  }
+  std::pmr::memory_resource* arena = session.arena.get();
+
+  size_t queued = 0;
+  for(const HttpResponse& response : out) {
+    queued += response.memoryBytes();
   }
+  session.outputFull = false;
+
+  while(keepAlive && (consumed < in.size() || session.upload)) {
+    // A client that pipelines requests without reading the responses gets no more
+    // until it catches up. An upload body is still taken: it only grows the file on disk.
+    if(queued >= outputLimit && !session.upload) {
+      session.outputFull = true;
+      break;
+    }
+
+    // A POST body is streamed to disk as it arrives instead of being buffered whole
+    if(session.upload) {
+      Upload& upload = *session.upload;
+      consumed += upload.feed(in.data() + consumed, in.size() - consumed);
+      if(upload.error() != 0) {
+        queueResponse(out, queued, errorResponse(upload.error(), arena), "POST", session.uploadTarget, session.requestStart, arena);
+        keepAlive = false;
+        consumed = in.size();
+        session.upload.reset();
+        break;
+      }
+      if(!upload.done()) {
+        break;  // rest of the body still arriving
+      }
+
+      // The head is long gone; match again on the saved target to recover the parameters
+      keepAlive = session.uploadKeepAlive && !lifecycle().draining();
+      const Route& route = router().route(session.uploadRoute);
+      std::string_view path(session.uploadTarget);
+      path = path.substr(0, path.find('?'));
+      HttpRequest head;
+      head.method = methodName(route.method);
+      head.target = session.uploadTarget;
+      RouteParams params;
+      router().match(head.method, path, params);
+      uint64_t handlerStart = monotonicNanos();
+      HttpResponse response = runRoute(route, RouteContext{head, params, std::string_view(), &upload, arena});
+      metrics().recordPhase(PhaseHandler, handlerStart);
+      if(!keepAlive) {
+        addConnectionClose(response);
+      }
+      queueResponse(out, queued, std::move(response), head.method, session.uploadTarget, session.requestStart, arena);
+      session.upload.reset();
+      session.parser.reset();
+      continue;
+    }
+
+    // The parser resumes where it stopped, so fragmented heads are scanned once
+    bool newHead = !session.parser.headParsed();
+    uint64_t parseStart = monotonicNanos();
+    HttpParser::Status status = session.parser.parse(in.data() + consumed, in.size() - consumed, request);
+    if(status == HttpParser::Incomplete) {
+      break;  // wait for the rest of the headers
+    }
+    if(newHead) {
+      // Not when only the body was still missing last time round
+      metrics().recordPhase(PhaseParse, parseStart);
+      metrics().requestParsed();
+      session.requestStart = parseStart;
+    }
+    if(status == HttpParser::Error) {
+      queueResponse(out, queued, errorResponse(session.parser.error(), arena), "", "", session.requestStart, arena);
+      keepAlive = false;
+      consumed = in.size();
+      break;
+    }
 
-  std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-  std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(content.length()) + "\r\n\r\n" + content;
+    // Routed as soon as the head is in, since upload routes take the body as it arrives
+    std::string_view path = request.target.substr(0, request.target.find('?'));
+    RouteParams params;
+    const Route* route = router().match(request.method, path, params);
+
+    if(route && route->streamsBody) {
+      int errorStatus = 0;
+      session.upload = uploadStore().begin(request.target, request.chunked, request.contentLength, errorStatus);
+      if(!session.upload) {
+        queueResponse(out, queued, errorResponse(errorStatus, arena), request.method, request.target, session.requestStart, arena);
+        keepAlive = false;
+        consumed = in.size();
+        break;
+      }
+      session.uploadTarget.assign(request.target.data(), request.target.size());
+      session.uploadRoute = route->index;
+      session.uploadKeepAlive = request.keepAlive;
+      if(request.header("Expect") == "100-continue") {
+        out.emplace_back("HTTP/1.1 100 Continue\r\n\r\n", arena);
+        queued += out.back().memoryBytes();
+      }
+      consumed += request.headerLength;
+      continue;
+    }
+    if(request.chunked) {
+      queueResponse(out, queued, errorResponse(501, arena), request.method, request.target, session.requestStart, arena);
+      keepAlive = false;
+      consumed = in.size();
+      break;
+    }
 
+    if(request.contentLength > kMaxBufferedBody) {
+      queueResponse(out, queued, errorResponse(413, arena), request.method, request.target, session.requestStart, arena);
+      keepAlive = false;
+      consumed = in.size();
+      break;
+    }
+
+    size_t requestLength = request.headerLength + request.contentLength;
+    if(requestLength > in.size() - consumed) {
+      break;  // body still arriving
+    }
+
+    // Once the server drains, each connection ends after the last request it has already
+    // sent; requests pipelined behind that one are left for the client to retry
+    keepAlive = request.keepAlive && (!lifecycle().draining() || consumed + requestLength < in.size());
+    std::string_view body(in.data() + consumed + request.headerLength, request.contentLength);
+    uint64_t handlerStart = monotonicNanos();
+    HttpResponse response = generateHttpResponse(request, route, params, body, arena);
+    metrics().recordPhase(PhaseHandler, handlerStart);
+    if(!keepAlive) {
+      addConnectionClose(response);
+    }
+    queueResponse(out, queued, std::move(response), request.method, request.target, session.requestStart, arena);
+    consumed += requestLength;
+    session.parser.reset();
+  }
+
+  in.erase(0, consumed);
+  return keepAlive;
+}
+
+HttpResponse generateHttpResponse(const HttpRequest& request, const Route* route, const RouteParams& params,
+                                  std::string_view body, std::pmr::memory_resource* arena) {
+  if(route) {
+    return runRoute(*route, RouteContext{request, params, body, nullptr, arena});
+  }
+
+  if(parseMethod(request.method) == MethodCount) {
+    return HttpResponse("HTTP/1.1 501 Not Implemented\r\nContent-Length: 0\r\n\r\n", arena);
+  }
+  std::string allowed = router().allowedMethods(request.target.substr(0, request.target.find('?')));
+  if(allowed.empty()) {
+    return HttpResponse("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", arena);
+  }
+  HttpResponse response("HTTP/1.1 405 Method Not Allowed\r\nAllow: ", arena);
+  response.data.append(allowed).append("\r\nContent-Length: 0\r\n\r\n");
+  return response;
+}
+
+void registerDefaultRoutes() {
+  Router& table = router();
+  table.add("GET", "/metrics", handleMetricsRequest);
+  table.add("GET", "/health", handleHealthRequest);
+  table.add("GET", "/*path", handleGetRequest);
+  table.add("POST", "/*path", handlePostRequest, true);
+}
+
+// 200 response whose body is sent from file with sendfile; only the headers are built here
+static HttpResponse fileResponse(const std::shared_ptr<const OpenFile>& file, std::string_view extraHeaders,
+                                 std::pmr::memory_resource* arena) {
+  char length[24];
+  char* end = std::to_chars(length, length + sizeof(length), file->size).ptr;
+  HttpResponse response(arena);
+  response.data.append("HTTP/1.1 200 OK\r\n").append(extraHeaders);
+  response.data.append("Content-Length: ").append(length, end).append("\r\n\r\n");
+  response.file = file;
+  response.addFileRegion(0, file->size);
   return response;
 }
 
-std::string handlePostRequest(const std::string& resource, const std::string& body) {
-  // For simplicity, save to a fixed filename
-  std::ofstream file("uploaded_file.txt");
+// 304 for a client whose copy is current: the validators, no body
+static HttpResponse notModifiedResponse(std::string_view etag, const OpenFile& file, std::string_view vary,
+                                        std::pmr::memory_resource* arena) {
+  HttpResponse response(arena);
+  response.data.append("HTTP/1.1 304 Not Modified\r\n").append(vary);
+  response.data.append("ETag: ").append(etag).append("\r\nLast-Modified: ").append(file.lastModified);
+  response.data.append("\r\n\r\n");
+  return response;
+}
+
+// 416 when no requested range overlaps the file
+static HttpResponse rangeNotSatisfiable(size_t size, std::pmr::memory_resource* arena) {
+  char length[24];
+  char* end = std::to_chars(length, length + sizeof(length), size).ptr;
+  HttpResponse response(arena);
+  response.data.append("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */").append(length, end);
+  response.data.append("\r\nContent-Length: 0\r\n\r\n");
+  return response;
+}
+
+// Append "first-last/size" for a Content-Range header
+static void appendContentRange(std::string& out, const ByteRange& range, size_t size) {
+  char number[24];
+  out.append(number, std::to_chars(number, number + sizeof(number), range.first).ptr).append("-");
+  out.append(number, std::to_chars(number, number + sizeof(number), range.first + range.length - 1).ptr).append("/");
+  out.append(number, std::to_chars(number, number + sizeof(number), size).ptr);
+}
+
+// 206 carrying the ranges of file. One range is sent as it is; several go out as
+// multipart/byteranges, the part headers in the arena and every range as a file region.
+static HttpResponse partialResponse(const std::shared_ptr<const OpenFile>& file, const std::vector<ByteRange>& ranges,
+                                    std::string_view extraHeaders, std::pmr::memory_resource* arena) {
+  thread_local std::string scratch;
+  size_t bodyLength = 0;
+  HttpResponse response(arena);
+  response.file = file;
+  response.data.append("HTTP/1.1 206 Partial Content\r\n").append(extraHeaders);
+
+  if(ranges.size() == 1) {
+    scratch.assign("Content-Range: bytes ");
+    appendContentRange(scratch, ranges[0], file->size);
+    response.data.append(scratch).append("\r\n");
+    response.addFileRegion(ranges[0].first, ranges[0].length);
+    bodyLength = ranges[0].length;
+  }
+  else {
+    // The boundary only has to be absent from the body; a fresh number per response will do
+    thread_local uint64_t counter = 0;
+    char boundary[17];
+    snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)(monotonicNanos() ^ (++counter << 48)));
+    response.data.append("Content-Type: multipart/byteranges; boundary=").append(boundary).append("\r\n");
+
+    for(const ByteRange& range : ranges) {
+      scratch.assign("\r\n--").append(boundary).append("\r\nContent-Range: bytes ");
+      appendContentRange(scratch, range, file->size);
+      scratch.append("\r\n\r\n");
+      response.addBytes(arenaCopy(scratch, arena));
+      response.addFileRegion(range.first, range.length);
+    }
+    scratch.assign("\r\n--").append(boundary).append("--\r\n");
+    response.addBytes(arenaCopy(scratch, arena));
+    bodyLength = response.bodyLength;
+  }
+
+  char length[24];
+  char* end = std::to_chars(length, length + sizeof(length), bodyLength).ptr;
+  response.data.append("Content-Length: ").append(length, end).append("\r\n\r\n");
+  return response;
+}
+
+HttpResponse handleGetRequest(const RouteContext& context) {
+  const HttpRequest& request = context.request;
+  std::pmr::memory_resource* arena = context.arena;
+  std::string_view resource = context.params.get("path");
+
+  // The caches are keyed by std::string; reuse one per thread instead of allocating per request
+  thread_local std::string filename;
+  filename.assign(resource.empty() ? std::string_view("index.html") : resource);
+  std::shared_ptr<const OpenFile> file = fileCache().open(filename);
+
   if(!file) {
-    return "HTTP/1.1 500 Internal Server Error\r\n\r\n";
+    return HttpResponse("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", arena);
+  }
+
+  // Text assets go out gzip-encoded to clients that accept it. Both variants say
+  // Vary so shared caches keep them apart. Ranges are always served from the
+  // unencoded file.
+  GzipCache& gzip = gzipCache();
+  bool negotiable = gzip.enabled() && file->size >= kMinGzipBytes && compressibleType(filename);
+  std::string_view vary = negotiable ? "Vary: Accept-Encoding\r\n" : "";
+  std::string_view range = request.header("Range");
+  bool wantsGzip = negotiable && range.empty() && acceptsGzip(request.header("Accept-Encoding"));
+
+  // Revalidation costs only headers when the client's copy is current. A client may
+  // hold either variant of a negotiable file; both change together.
+  std::string_view ifNoneMatch = request.header("If-None-Match");
+  std::string_view ifModifiedSince = request.header("If-Modified-Since");
+  if(!ifNoneMatch.empty() || !ifModifiedSince.empty()) {
+    thread_local std::string gzipTag;
+    std::string_view etag = file->etag;
+    if(wantsGzip) {
+      gzipTag = gzipEtag(*file);
+      if(ifNoneMatch.empty() || etagMatches(ifNoneMatch, gzipTag)) {
+        etag = gzipTag;
+      }
+    }
+    if(notModified(ifNoneMatch, ifModifiedSince, etag, file->mtime.tv_sec)) {
+      return notModifiedResponse(etag, *file, vary, arena);
+    }
+  }
+
+  // Headers of every response carrying the file's own bytes
+  thread_local std::string headers;
+  headers.assign(vary).append("Accept-Ranges: bytes\r\nETag: ").append(file->etag);
+  headers.append("\r\nLast-Modified: ").append(file->lastModified).append("\r\n");
+
+  // Resumed downloads get just the bytes they ask for, unless the file changed since
+  // (If-Range)
+  if(!range.empty() && ifRangeMatches(request.header("If-Range"), file->etag, file->mtime.tv_sec)) {
+    thread_local std::vector<ByteRange> ranges;
+    RangeStatus status = parseRange(range, file->size, ranges);
+    if(status == RangeNotSatisfiable) {
+      return rangeNotSatisfiable(file->size, arena);
+    }
+    if(status == RangeSatisfiable) {
+      return partialResponse(file, ranges, headers, arena);
+    }
+  }
+
+  if(wantsGzip) {
+    if(gzip.eligible(filename, file->size)) {
+      HttpResponse response(arena);
+      response.cached = gzip.get(filename, *file);
+      if(response.cached) {
+        return response;
+      }
+    }
+    else {
+      // Too big to compress per request, but a precompressed sibling can be sent as is
+      thread_local std::string siblingName;
+      siblingName.assign(filename).append(".gz");
+      std::shared_ptr<const OpenFile> sibling = fileCache().open(siblingName);
+      if(sibling && siblingUpToDate(*sibling, *file)) {
+        thread_local std::string gzipHeaders;
+        gzipHeaders.assign("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\nETag: ").append(gzipEtag(*file));
+        gzipHeaders.append("\r\nLast-Modified: ").append(file->lastModified).append("\r\n");
+        return fileResponse(sibling, gzipHeaders, arena);
+      }
+    }
+  }
+
+  // Small, hot files are answered from a prebuilt headers + body buffer
+  ResponseCache& cache = responseCache();
+  if(cache.eligible(file->size)) {
+    HttpResponse response(arena);
+    response.cached = cache.lookup(filename, *file);
+    if(!response.cached) {
+      response.cached = cache.fill(filename, *file, headers);
+    }
+    if(response.cached) {
+      return response;
+    }
+  }
+
+  return fileResponse(file, headers, arena);
+}
+
+HttpResponse handlePostRequest(const RouteContext& context) {
+  // The stored name was derived from the target by UploadStore
+  Upload& upload = *context.upload;
+  std::pmr::memory_resource* arena = context.arena;
+  if(!upload.commit()) {
+    return errorResponse(upload.error(), arena);
   }
 
-  file << body;
-  return "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nOK";
-}
\ No newline at end of file
+  // Tell the client where its upload can be fetched, when GET can reach it at all
+  std::string location = upload.location().empty() ? std::string() : "Location: " + upload.location() + "\r\n";
+  std::string body = std::to_string(upload.size()) + " bytes\n";
+  return HttpResponse("HTTP/1.1 201 Created\r\n" + location +
+                      "Content-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                      "\r\n\r\n" + body, arena);
+}
+
+HttpResponse handleHealthRequest(const RouteContext& context) {
+  return HttpResponse("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 3\r\n\r\nok\n", context.arena);
+}
+
+HttpResponse handleMetricsRequest(const RouteContext& context) {
+  std::pmr::memory_resource* arena = context.arena;
+  std::pmr::string body(arena);
+  metrics().render(body);
+
+  char length[24];
+  char* end = std::to_chars(length, length + sizeof(length), body.size()).ptr;
+  HttpResponse response(arena);
+  response.data.reserve(body.size() + 96);
+  response.data.append("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ");
+  response.data.append(length, end).append("\r\n\r\n").append(body);
+  return response;
+}
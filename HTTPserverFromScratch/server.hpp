@@ -2,21 +2,158 @@
 #define SERVER_HPP
 
 #include <string>
+#include <cstdint>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string_view>
+#include <memory_resource>
+#include "arena.hpp"
+#include "config.hpp"
+#include "file_cache.hpp"
+#include "http_parser.hpp"
+#include "upload.hpp"
 
-// Utility function to handle each client connection
-void handleConnection(int client_fd);
+// One piece of a response body. In-memory pieces point at bytes that live at least as
+// long as the response (the session arena or a shared cache buffer); file pieces are
+// regions of HttpResponse::file, sent straight from the page cache with sendfile().
+struct ResponseSegment {
+  const char* data;  // nullptr for a file region
+  size_t length;
+  off_t fileOffset;  // file regions only
+};
 
-// Utility function to parse HTTP request headers
-std::vector<std::string> parseRequestHeaders(const std::string& request);
+// A response ready to be written: the status line and headers in memory, followed by
+// the body segments in order
+struct HttpResponse {
+  std::pmr::string data;                      // status line, headers and any in-memory body
+  std::shared_ptr<const std::string> cached;  // prebuilt response shared with the ResponseCache (replaces data)
+  std::shared_ptr<const OpenFile> file;       // file the body's file regions are read from
+  std::pmr::vector<ResponseSegment> body;     // sent after bytes()
+  size_t bodyLength = 0;                      // total of body's lengths
+  size_t fileBytes = 0;                       // the part of bodyLength that is file regions
 
-// Function to Generate an HTTP response
-std::string generateHttpResponse(const std::string& request);
+  // Access log details, set by processRequests when the access log is on
+  std::string_view logMethod;  // copies in the session arena
+  std::string_view logTarget;
+  uint64_t logStart = 0;       // monotonicNanos() when the request head was parsed; 0 = not logged
 
-// Utility function to handle GET requests
-std::string handleGetRequest(const std::string& resource);
+  HttpResponse() = default;
+  explicit HttpResponse(std::pmr::memory_resource* arena) : data(arena), body(arena) {}
+  HttpResponse(std::string_view text, std::pmr::memory_resource* arena) : data(text, arena), body(arena) {}
 
-// Utility function to handle POST requests
-std::string handlePostRequest(const std::string& resource, const std::string& body);
+  // The in-memory bytes, wherever they live
+  std::string_view bytes() const { return cached ? std::string_view(*cached) : std::string_view(data); }
+
+  size_t size() const { return bytes().size() + bodyLength; }
+
+  // Bytes held in memory until the response is sent, which is what the output cap counts
+  size_t memoryBytes() const { return size() - fileBytes; }
+
+  // Append length bytes of file starting at offset
+  void addFileRegion(off_t offset, size_t length) {
+    body.push_back(ResponseSegment{nullptr, length, offset});
+    bodyLength += length;
+    fileBytes += length;
+  }
+
+  // Append in-memory bytes; they are not copied and must outlive the response
+  void addBytes(std::string_view bytes) {
+    body.push_back(ResponseSegment{bytes.data(), bytes.size(), 0});
+    bodyLength += bytes.size();
+  }
+};
+
+// Write as much of `out` as the socket accepts, starting `offset` bytes into out.front().
+// The in-memory parts of consecutive responses go out together in one sendmsg() and
+// file regions with sendfile(). Finished responses are recorded and popped; `offset`
+// and `sendStart` (when writing the new front began) follow along. Returns false on a
+// socket error. On a non-blocking socket `out` may be left non-empty when the socket is full.
+bool writeResponses(int client_fd, std::deque<HttpResponse>& out, size_t& offset, uint64_t& sendStart);
+
+// Largest number of iovecs gatherResponses() fills
+const int kMaxWriteIov = 64;
+
+// Fill iov with the in-memory bytes at the front of `out`, starting `offset` bytes into
+// out.front(), up to the next file region. Returns the number of entries used; 0 means
+// the next byte to send is in a file region.
+int gatherResponses(const std::deque<HttpResponse>& out, size_t offset, struct iovec* iov, int maxIov);
+
+// sendfile() the file region that holds byte `offset` of response. Returns what
+// sendfile() returned.
+ssize_t sendFileRegion(int client_fd, const HttpResponse& response, size_t offset);
+
+// Account for `written` more bytes of `out`: pop and record every response that is now
+// complete, moving offset and sendStart (set to now for the next response) along
+void advanceResponses(std::deque<HttpResponse>& out, size_t& offset, size_t written, uint64_t& sendStart, uint64_t now);
+
+// Request state that carries over from one read to the next on a connection
+struct HttpSession {
+  HttpParser parser;               // progress through the head at the front of the buffer
+  std::unique_ptr<Upload> upload;  // POST body currently being streamed to disk
+  std::string uploadTarget;
+  size_t uploadRoute = 0;          // Route::index of the route the upload is for
+  bool uploadKeepAlive = true;
+  uint64_t requestStart = 0;       // monotonicNanos() when the current request's head was parsed
+  bool outputFull = false;         // processRequests stopped at the output cap; call it again once `out` drains
+  Arena arena;                     // response assembly; reset whenever no response is pending
+
+  explicit HttpSession(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : arena(upstream) {}
+};
+
+// Create a TCP socket bound to port with SO_REUSEPORT and start listening. Returns -1 on failure.
+int createListeningSocket(int port, int backlog);
+
+// Utility function to handle each client connection (blocking, one thread per client).
+// Serves requests until the client closes, asks to close, stays idle for config.idleTimeout,
+// or the server drains.
+// accepted_ns is the monotonicNanos() time accept() returned, for the accept-phase metric.
+void handleConnection(int client_fd, const ServerConfig& config, uint64_t accepted_ns);
+
+// Record a response whose last byte has just been handed to the kernel in the metrics
+// and access log; sendStart is when writing it began
+void recordResponseSent(const HttpResponse& response, uint64_t sendStart);
+
+// Largest body buffered for a route that does not stream it to disk; a longer
+// Content-Length is answered with 413 and the connection closed
+const size_t kMaxBufferedBody = 64 * 1024;
+
+// Handle every complete request at the front of `in` in order, appending the responses
+// to `out` and erasing the consumed bytes. Responses are built in session.arena, which is
+// reset on entry when `out` is empty, so `out` must not outlive the session. Incomplete requests are left in `in`, except
+// POST bodies, which are handed to the session's Upload and written to disk as they arrive.
+// Once the in-memory bytes queued in `out` reach outputLimit the rest of `in` is left alone
+// and session.outputFull is set; callers stop reading until `out` has drained.
+// Returns false once the connection should be closed after `out` is sent.
+bool processRequests(HttpSession& session, std::string& in, std::deque<HttpResponse>& out,
+                     size_t outputLimit = SIZE_MAX);
+
+struct Route;
+struct RouteParams;
+struct RouteContext;
+
+// Function to Generate an HTTP response for one parsed request and its body: run the
+// handler of the route it matched, or answer 404, 405 or 501 when route is null. The
+// response's own bytes are allocated from arena.
+HttpResponse generateHttpResponse(const HttpRequest& request, const Route* route, const RouteParams& params,
+                                  std::string_view body, std::pmr::memory_resource* arena);
+
+// Register the built-in routes with router(); called once at startup
+void registerDefaultRoutes();
+
+// GET /*path: static files (the body is sent from the file cache with sendfile)
+HttpResponse handleGetRequest(const RouteContext& context);
+
+// GET /metrics: the process-wide counters and latency histograms in Prometheus text format
+HttpResponse handleMetricsRequest(const RouteContext& context);
+
+// GET /health: liveness check answered without touching disk
+HttpResponse handleHealthRequest(const RouteContext& context);
+
+// POST /*path, once the whole body has been streamed into context.upload
+HttpResponse handlePostRequest(const RouteContext& context);
 
 #endif // SERVER_HPP
\ No newline at end of file
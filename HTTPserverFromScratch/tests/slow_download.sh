@@ -0,0 +1,53 @@
+#!/bin/sh
+# Downloads a file more slowly than the idle timeout allows for the whole transfer,
+# and checks that every byte arrives. The connection is busy sending, not idle.
+#   tests/slow_download.sh [io modes...]
+# Run from the project root after building ./server. Needs python3.
+MODES=${*:-threads epoll uring}
+PORT=4324
+SIZE=40000000
+ROOT=$(pwd)
+DOCROOT=$(mktemp -d)
+status=0
+
+head -c $SIZE /dev/zero > "$DOCROOT/big.bin"
+
+for io in $MODES; do
+    (cd "$DOCROOT" && exec "$ROOT/server" --port $PORT --io "$io" --idle-timeout 1) >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    # About five seconds at 8 MB/s against a one second idle timeout. The small receive
+    # buffer keeps the client's kernel from soaking up seconds of the file at once, so
+    # the server sees the download progress steadily.
+    got=$(python3 - $PORT <<'PY'
+import socket, sys, time
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 256 * 1024)
+s.connect(("127.0.0.1", int(sys.argv[1])))
+s.sendall(b"GET /big.bin HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+head, got, start = b"", 0, time.monotonic()
+while True:
+    data = s.recv(64 * 1024)
+    if not data:
+        break
+    if not head:
+        head, _, data = data.partition(b"\r\n\r\n")
+    got += len(data)
+    time.sleep(max(0, start + got / 8e6 - time.monotonic()))
+print(got)
+PY
+)
+    if [ "$got" = "$SIZE" ]; then
+        echo "ok   $io"
+    else
+        echo "FAIL $io: received $got of $SIZE bytes"
+        status=1
+    fi
+
+    kill -9 "$pid"
+    wait "$pid" 2>/dev/null
+done
+
+rm -rf "$DOCROOT"
+exit $status
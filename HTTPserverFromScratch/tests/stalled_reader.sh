@@ -0,0 +1,56 @@
+#!/bin/sh
+# Asks for a large file and then stops reading, leaving the server with a full socket
+# and queued output. Checks that the connection is still closed after the idle timeout.
+#   tests/stalled_reader.sh [io modes...]
+# Run from the project root after building ./server. Needs python3.
+MODES=${*:-epoll uring}
+PORT=4325
+SIZE=40000000
+ROOT=$(pwd)
+DOCROOT=$(mktemp -d)
+status=0
+
+head -c $SIZE /dev/zero > "$DOCROOT/big.bin"
+
+for io in $MODES; do
+    (cd "$DOCROOT" && exec "$ROOT/server" --port $PORT --io "$io" --idle-timeout 1) >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    # Read nothing for four seconds, then see whether the server has hung up: a closed
+    # connection ends in EOF (or a reset) well before the whole file has arrived
+    result=$(python3 - $PORT $SIZE <<'PY'
+import socket, sys, time
+port, size = int(sys.argv[1]), int(sys.argv[2])
+s = socket.create_connection(("127.0.0.1", port))
+s.sendall(b"GET /big.bin HTTP/1.1\r\nHost: localhost\r\n\r\n")
+time.sleep(4)
+s.settimeout(5)
+got = 0
+try:
+    while True:
+        data = s.recv(1 << 16)
+        if not data:
+            break
+        got += len(data)
+except ConnectionResetError:
+    pass
+except socket.timeout:
+    print("open")
+    sys.exit()
+print("closed" if got < size else "complete")
+PY
+)
+    if [ "$result" = "closed" ]; then
+        echo "ok   $io"
+    else
+        echo "FAIL $io: connection $result after the idle timeout"
+        status=1
+    fi
+
+    kill -9 "$pid"
+    wait "$pid" 2>/dev/null
+done
+
+rm -rf "$DOCROOT"
+exit $status
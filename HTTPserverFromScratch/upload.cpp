@@ -0,0 +1,308 @@
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "upload.hpp"
+
+Upload::Upload(int fd, std::string tempPath, std::string finalPath, std::string url, bool chunked, size_t contentLength,
+               size_t maxBytes)
+    : fd(fd), tempPath(std::move(tempPath)), finalPath(std::move(finalPath)), url(std::move(url)),
+      buffer(new char[kUploadChunkBytes]), buffered(0), chunked(chunked),
+      remaining(chunked ? 0 : contentLength), received(0), maxBytes(maxBytes),
+      chunkState(ChunkSize), lineHasData(false), sawDigit(false), errorStatus(0), committed(false) {
+  if(!chunked && contentLength > maxBytes) {
+    errorStatus = 413;
+  }
+}
+
+Upload::~Upload() {
+  close(fd);
+  if(!committed) {
+    unlink(tempPath.c_str());
+  }
+}
+
+bool Upload::flushBuffer() {
+  size_t written = 0;
+  while(written < buffered) {
+    ssize_t nbytes = write(fd, buffer.get() + written, buffered - written);
+    if(nbytes < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      errorStatus = 500;
+      return false;
+    }
+    written += nbytes;
+  }
+  buffered = 0;
+  return true;
+}
+
+// Copy decoded body bytes into the staging buffer, writing it out each time it fills
+bool Upload::append(const char* data, size_t len) {
+  received += len;
+  while(len > 0) {
+    size_t n = std::min(len, kUploadChunkBytes - buffered);
+    memcpy(buffer.get() + buffered, data, n);
+    buffered += n;
+    data += n;
+    len -= n;
+    if(buffered == kUploadChunkBytes && !flushBuffer()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t Upload::feed(const char* data, size_t len) {
+  if(errorStatus != 0) {
+    return 0;
+  }
+  if(chunked) {
+    return feedChunked(data, len);
+  }
+
+  size_t n = std::min(len, remaining);
+  if(n > 0 && append(data, n)) {
+    remaining -= n;
+  }
+  return n;
+}
+
+static int hexValue(char c) {
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+size_t Upload::feedChunked(const char* data, size_t len) {
+  size_t pos = 0;
+  while(pos < len && chunkState != Finished && errorStatus == 0) {
+    char c = data[pos];
+
+    if(chunkState == ChunkData) {
+      size_t n = std::min(len - pos, remaining);
+      if(!append(data + pos, n)) {
+        break;
+      }
+      remaining -= n;
+      pos += n;
+      if(remaining == 0) {
+        chunkState = ChunkDataCR;
+      }
+      continue;
+    }
+
+    bool sizeLineDone = false;
+    switch(chunkState) {
+      case ChunkSize: {
+        int digit = hexValue(c);
+        if(digit >= 0) {
+          if(remaining > (SIZE_MAX >> 4)) {
+            errorStatus = 413;
+            break;
+          }
+          remaining = (remaining << 4) | digit;
+          sawDigit = true;
+        }
+        else if(c == ';') {
+          chunkState = ChunkExtension;
+        }
+        else if(c == '\r') {
+          chunkState = ChunkSizeLF;
+        }
+        else if(c == '\n') {
+          sizeLineDone = true;
+        }
+        else {
+          errorStatus = 400;
+        }
+        break;
+      }
+
+      case ChunkExtension:
+        // Extensions are allowed but ignored
+        if(c == '\r') {
+          chunkState = ChunkSizeLF;
+        }
+        else if(c == '\n') {
+          sizeLineDone = true;
+        }
+        break;
+
+      case ChunkSizeLF:
+        if(c == '\n') {
+          sizeLineDone = true;
+        }
+        else {
+          errorStatus = 400;
+        }
+        break;
+
+      case ChunkDataCR:
+        if(c == '\r') {
+          chunkState = ChunkDataLF;
+        }
+        else if(c == '\n') {
+          chunkState = ChunkSize;
+          sawDigit = false;
+        }
+        else {
+          errorStatus = 400;
+        }
+        break;
+
+      case ChunkDataLF:
+        if(c == '\n') {
+          chunkState = ChunkSize;
+          sawDigit = false;
+        }
+        else {
+          errorStatus = 400;
+        }
+        break;
+
+      case Trailer:
+        if(c == '\r') {
+          chunkState = TrailerLF;
+        }
+        else if(c == '\n') {
+          chunkState = lineHasData ? Trailer : Finished;
+          lineHasData = false;
+        }
+        else {
+          lineHasData = true;
+        }
+        break;
+
+      case TrailerLF:
+        if(c != '\n') {
+          errorStatus = 400;
+          break;
+        }
+        chunkState = lineHasData ? Trailer : Finished;
+        lineHasData = false;
+        break;
+
+      default:
+        break;
+    }
+    ++pos;
+
+    if(sizeLineDone) {
+      if(!sawDigit) {
+        errorStatus = 400;
+      }
+      else if(received + remaining > maxBytes) {
+        errorStatus = 413;
+      }
+      else {
+        // A zero-size chunk ends the body; optional trailer fields follow
+        chunkState = (remaining == 0) ? Trailer : ChunkData;
+      }
+    }
+  }
+  return pos;
+}
+
+bool Upload::commit() {
+  if(!flushBuffer()) {
+    return false;
+  }
+  if(rename(tempPath.c_str(), finalPath.c_str()) != 0) {
+    errorStatus = 500;
+    return false;
+  }
+  committed = true;
+  return true;
+}
+
+UploadStore::UploadStore()
+    : directory("uploads"), maxBytes(1024UL * 1024 * 1024), counter(0),
+      namePrefix(std::to_string(time(nullptr)) + "-" + std::to_string(getpid()) + "-") {
+}
+
+bool UploadStore::configure(const std::string& dir, size_t max) {
+  directory = dir.empty() ? "." : dir;
+  maxBytes = max;
+  if(mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Cannot create upload directory " << directory << ": " << strerror(errno) << "\n";
+    return false;
+  }
+
+  // GET serves paths relative to the working directory; uploads elsewhere have no URL
+  char root[PATH_MAX], dirPath[PATH_MAX];
+  urlPrefix.clear();
+  if(realpath(".", root) && realpath(directory.c_str(), dirPath)) {
+    std::string rootDir(root), uploadDir(dirPath);
+    if(rootDir.back() != '/') {
+      rootDir += '/';
+    }
+    uploadDir += '/';
+    if(uploadDir.compare(0, rootDir.size(), rootDir) == 0) {
+      urlPrefix = "/" + uploadDir.substr(rootDir.size());
+    }
+  }
+  return true;
+}
+
+// Keep only the last path component and characters that are safe in a file name
+static std::string safeName(std::string_view target) {
+  size_t query = target.find('?');
+  if(query != std::string_view::npos) {
+    target = target.substr(0, query);
+  }
+  size_t slash = target.rfind('/');
+  if(slash != std::string_view::npos) {
+    target = target.substr(slash + 1);
+  }
+
+  std::string name;
+  for(char c : target) {
+    if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '_') {
+      name += c;
+    }
+  }
+  if(name.empty() || name[0] == '.') {
+    name = "upload" + name;
+  }
+  return name;
+}
+
+std::unique_ptr<Upload> UploadStore::begin(std::string_view target, bool chunked, size_t contentLength, int& errorStatus) {
+  if(!chunked && contentLength > maxBytes) {
+    errorStatus = 413;
+    return nullptr;
+  }
+
+  // Stage under a hidden temporary name in the same directory, so the final rename is atomic
+  std::string tempPath = directory + "/.upload-XXXXXX";
+  int fd = mkstemp(&tempPath[0]);
+  if(fd < 0) {
+    errorStatus = 500;
+    return nullptr;
+  }
+  fchmod(fd, 0644);  // mkstemp creates 0600
+
+  // Every upload gets its own final name, so concurrent uploads never overwrite each other,
+  // even across the old and new process of a restart or several reuseport instances
+  unsigned long id = counter.fetch_add(1, std::memory_order_relaxed);
+  std::string name = namePrefix + std::to_string(id) + "-" + safeName(target);
+  std::string finalPath = directory + "/" + name;
+  std::string url = urlPrefix.empty() ? std::string() : urlPrefix + name;
+
+  errorStatus = 0;
+  return std::unique_ptr<Upload>(new Upload(fd, tempPath, finalPath, url, chunked, contentLength, maxBytes));
+}
+
+UploadStore& uploadStore() {
+  static UploadStore store;
+  return store;
+}
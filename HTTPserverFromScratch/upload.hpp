@@ -0,0 +1,92 @@
+#ifndef UPLOAD_HPP
+#define UPLOAD_HPP
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+
+// Size of the staging buffer each upload writes to disk with; also the most
+// memory an upload ever holds, whatever the size of the body
+const size_t kUploadChunkBytes = 64 * 1024;
+
+// One POST body being streamed to disk. Bytes are fed in as they arrive, decoded
+// (Content-Length or chunked framing), collected into a fixed-size buffer and
+// written out whenever it fills. The file is staged under a temporary name and
+// only appears under its final, unique name through an atomic rename() in commit().
+class Upload {
+  private:
+    enum ChunkState { ChunkSize, ChunkExtension, ChunkSizeLF, ChunkData, ChunkDataCR, ChunkDataLF, Trailer, TrailerLF, Finished };
+
+    int fd;
+    std::string tempPath;
+    std::string finalPath;
+    std::string url;           // where GET serves finalPath; empty when it is outside the served root
+    std::unique_ptr<char[]> buffer;
+    size_t buffered;
+
+    bool chunked;
+    size_t remaining;         // bytes left in the body (Content-Length) or current chunk
+    size_t received;          // decoded body bytes so far
+    size_t maxBytes;
+    ChunkState chunkState;
+    bool lineHasData;         // current trailer line is non-empty
+    bool sawDigit;            // current chunk-size line has at least one hex digit
+    int errorStatus;
+    bool committed;
+
+    bool append(const char* data, size_t len);
+    bool flushBuffer();
+    size_t feedChunked(const char* data, size_t len);
+
+  public:
+    Upload(int fd, std::string tempPath, std::string finalPath, std::string url, bool chunked, size_t contentLength,
+           size_t maxBytes);
+    ~Upload();
+
+    Upload(const Upload&) = delete;
+    Upload& operator=(const Upload&) = delete;
+
+    // Consume body bytes from data[0, len). Stops at the end of the body and returns
+    // how many bytes were used, so anything after it belongs to the next request.
+    size_t feed(const char* data, size_t len);
+
+    // The whole body has been received
+    bool done() const { return errorStatus == 0 && (chunked ? chunkState == Finished : remaining == 0); }
+
+    // 0 while healthy, otherwise the HTTP status to answer with (400, 413, 500)
+    int error() const { return errorStatus; }
+
+    // Write out what is left, then move the file to its final name
+    bool commit();
+
+    const std::string& path() const { return finalPath; }
+    const std::string& location() const { return url; }
+    size_t size() const { return received; }
+};
+
+// Where uploads go and how large they may be, shared by all workers
+class UploadStore {
+  private:
+    std::string directory;
+    std::string urlPrefix;   // directory as a URL path ending in '/', or empty when GET cannot reach it
+    size_t maxBytes;
+    std::atomic<unsigned long> counter;
+    std::string namePrefix;  // "<start time>-<pid>-", so processes that overlap never pick the same name
+
+  public:
+    UploadStore();
+
+    // Set the target directory (created if missing) and the size limit. Returns false if unusable.
+    bool configure(const std::string& directory, size_t maxBytes);
+
+    // Start an upload for the request target. Returns nullptr and sets errorStatus if it cannot.
+    std::unique_ptr<Upload> begin(std::string_view target, bool chunked, size_t contentLength, int& errorStatus);
+
+    const std::string& dir() const { return directory; }
+};
+
+// Process-wide store used by the request handlers
+UploadStore& uploadStore();
+
+#endif // UPLOAD_HPP
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.hpp"
+
+static int sysSetup(unsigned entries, io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int sysRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+IoUring::IoUring(unsigned entries)
+    : sqeTail(0), submittedTail(0), bufRing(nullptr), bufRingSize(0), bufMemory(nullptr),
+      bufCount(0), bufSize(0), bufGroup(0), bufTail(0) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;  // multishot ops can post many completions per submission
+
+  ringFd = sysSetup(entries, &params);
+  if(ringFd < 0) {
+    throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+  }
+
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if(params.features & IORING_FEAT_SINGLE_MMAP) {
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+
+  sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  if(sqRing == MAP_FAILED) {
+    close(ringFd);
+    throw std::runtime_error("io_uring sq ring mmap failed");
+  }
+  cqRing = (params.features & IORING_FEAT_SINGLE_MMAP)
+             ? sqRing
+             : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+  sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqeMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if(cqRing == MAP_FAILED || sqeMemory == MAP_FAILED) {
+    close(ringFd);
+    throw std::runtime_error("io_uring mmap failed");
+  }
+  sqes = static_cast<io_uring_sqe*>(sqeMemory);
+
+  char* sq = static_cast<char*>(sqRing);
+  sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqEntries = params.sq_entries;
+
+  // SQE slots are used in order, so the index array is simply the identity
+  unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  for(unsigned i = 0; i < sqEntries; ++i) {
+    array[i] = i;
+  }
+
+  char* cq = static_cast<char*>(cqRing);
+  cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  if(bufRing) {
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufGroup;
+    sysRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufRing, bufRingSize);
+    free(bufMemory);
+  }
+  munmap(sqes, sqesSize);
+  if(cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  munmap(sqRing, sqRingSize);
+  close(ringFd);
+}
+
+io_uring_sqe* IoUring::getSqe() {
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  if(sqeTail - head >= sqEntries) {
+    submitAndWait(0);
+    head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if(sqeTail - head >= sqEntries) {
+      return nullptr;
+    }
+  }
+  io_uring_sqe* sqe = &sqes[sqeTail & sqMask];
+  ++sqeTail;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitNr) {
+  unsigned toSubmit = sqeTail - submittedTail;
+  __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+  submittedTail = sqeTail;
+
+  if(toSubmit == 0 && waitNr == 0) {
+    return 0;
+  }
+  int rc = sysEnter(ringFd, toSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+  return rc < 0 ? -errno : rc;
+}
+
+io_uring_cqe* IoUring::peekCqe() {
+  unsigned head = *cqHead;
+  if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    return nullptr;
+  }
+  return &cqes[head & cqMask];
+}
+
+void IoUring::cqeSeen() {
+  __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUring::setupBufferRing(unsigned short group, unsigned count, unsigned size) {
+  bufRingSize = count * sizeof(io_uring_buf);
+  void* ring = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if(ring == MAP_FAILED) {
+    return false;
+  }
+
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<unsigned long>(ring);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if(sysRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    munmap(ring, bufRingSize);
+    return false;
+  }
+
+  bufRing = static_cast<io_uring_buf_ring*>(ring);
+  bufMemory = static_cast<char*>(malloc((size_t)count * size));
+  bufCount = count;
+  bufSize = size;
+  bufGroup = group;
+  bufTail = 0;
+  for(unsigned id = 0; id < count; ++id) {
+    recycleBuffer(id);
+  }
+  commitBuffers();
+  return true;
+}
+
+// The ring is an array of io_uring_buf whose first entry's resv field doubles as the
+// tail. Index it by hand: in C++ the header's flexible-array wrapper puts bufs[] at
+// the wrong offset.
+void IoUring::recycleBuffer(unsigned id) {
+  io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(bufRing) + (bufTail & (bufCount - 1));
+  buf->addr = reinterpret_cast<unsigned long>(buffer(id));
+  buf->len = bufSize;
+  buf->bid = id;
+  ++bufTail;
+}
+
+void IoUring::commitBuffers() {
+  unsigned short* tail = &reinterpret_cast<io_uring_buf*>(bufRing)->resv;
+  __atomic_store_n(tail, bufTail, __ATOMIC_RELEASE);
+}
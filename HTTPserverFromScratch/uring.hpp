@@ -0,0 +1,76 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <cstddef>
+#include <linux/io_uring.h>
+
+// A minimal io_uring wrapper on top of the raw system calls: one submission and
+// one completion ring, plus an optional provided-buffer ring for receives.
+// Submissions are only queued by getSqe(); nothing reaches the kernel until
+// submitAndWait(), so every request prepared in one loop iteration costs a single
+// io_uring_enter() together with waiting for the next completions.
+class IoUring {
+  private:
+    int ringFd;
+
+    // Submission queue
+    void* sqRing;
+    size_t sqRingSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned sqeTail;        // next free SQE (local, published on submit)
+    unsigned submittedTail;  // what the kernel has already been told about
+
+    // Completion queue
+    void* cqRing;
+    size_t cqRingSize;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+
+    // Provided buffers
+    io_uring_buf_ring* bufRing;
+    size_t bufRingSize;
+    char* bufMemory;
+    unsigned bufCount;
+    unsigned bufSize;
+    unsigned short bufGroup;
+    unsigned short bufTail;  // local tail, published by commitBuffers()
+
+  public:
+    // Create a ring with room for `entries` submissions. Throws std::runtime_error if unsupported.
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // A zeroed SQE to fill in. If the queue is full, the queued SQEs are submitted first.
+    io_uring_sqe* getSqe();
+
+    // Submit everything queued and wait until at least waitNr completions are ready.
+    // Returns the number submitted, or -errno.
+    int submitAndWait(unsigned waitNr);
+
+    // The next completion, or nullptr if none is ready; release it with cqeSeen()
+    io_uring_cqe* peekCqe();
+    void cqeSeen();
+
+    // Register `count` buffers of `size` bytes as buffer group `group` for IOSQE_BUFFER_SELECT
+    // receives. count must be a power of two. Returns false if the kernel lacks support.
+    bool setupBufferRing(unsigned short group, unsigned count, unsigned size);
+
+    char* buffer(unsigned id) const { return bufMemory + (size_t)id * bufSize; }
+    unsigned bufferSize() const { return bufSize; }
+
+    // Hand a consumed buffer back to the kernel (visible after commitBuffers())
+    void recycleBuffer(unsigned id);
+    void commitBuffers();
+};
+
+#endif // URING_HPP
@@ -0,0 +1,412 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "uring_loop.hpp"
+#include "event_loop.hpp"
+#include "metrics.hpp"
+#include "lifecycle.hpp"
+#include "admission.hpp"
+
+static const unsigned kRingEntries = 1024;
+static const unsigned kRecvBuffers = 1024;        // per loop, must be a power of two
+static const unsigned kRecvBufferSize = 16384;
+static const unsigned short kRecvGroup = 0;
+
+static uint64_t tag(unsigned op, int fd) {
+  return ((uint64_t)op << 32) | (uint32_t)fd;
+}
+
+UringLoop::UringLoop(const ServerConfig& config, int listen_fd)
+    : ring(kRingEntries), listenFd(listen_fd), draining(false), timeoutArmed(false),
+      idleTimeout(config.idleTimeout), maxOutput(config.maxOutput) {
+  if(!ring.setupBufferRing(kRecvGroup, kRecvBuffers, kRecvBufferSize)) {
+    throw std::runtime_error("io_uring provided buffer rings are not supported by this kernel");
+  }
+  tick.tv_sec = 1;
+  tick.tv_nsec = 0;
+}
+
+io_uring_sqe* UringLoop::prepare(Op op, int fd) {
+  io_uring_sqe* sqe = ring.getSqe();
+  if(!sqe) {
+    throw std::runtime_error("io_uring submission queue overflow");
+  }
+  sqe->fd = fd;
+  sqe->user_data = tag(op, fd);
+  return sqe;
+}
+
+void UringLoop::armAccept() {
+  io_uring_sqe* sqe = prepare(OpAccept, listenFd);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void UringLoop::armRecv(Connection& conn) {
+  io_uring_sqe* sqe = prepare(OpRecv, conn.fd);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kRecvGroup;
+  conn.recvArmed = true;
+  ++conn.pending;
+}
+
+void UringLoop::cancelRecv(Connection& conn) {
+  if(!conn.recvArmed || conn.recvCancelling) {
+    return;
+  }
+  io_uring_sqe* sqe = prepare(OpCancel, conn.fd);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = tag(OpRecv, conn.fd);
+  conn.recvCancelling = true;
+  ++conn.pending;
+}
+
+void UringLoop::armTimeout() {
+  io_uring_sqe* sqe = prepare(OpTimeout, -1);
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<unsigned long>(&tick);
+  sqe->len = 1;
+  timeoutArmed = true;
+}
+
+void UringLoop::run() {
+  armAccept();
+  if(idleTimeout.count() > 0) {
+    armTimeout();
+  }
+  io_uring_sqe* sqe = prepare(OpDrain, lifecycle().drainFd());
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->poll32_events = POLLIN;
+
+  while(!draining || !connections.empty()) {
+    // One system call: submit everything prepared last round, wait for new completions
+    int rc = ring.submitAndWait(1);
+    if(rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+      std::cerr << "io_uring_enter failed: " << strerror(-rc) << "\n";
+      return;
+    }
+
+    io_uring_cqe* cqe;
+    while((cqe = ring.peekCqe()) != nullptr) {
+      unsigned op = cqe->user_data >> 32;
+      int fd = (int)(uint32_t)cqe->user_data;
+
+      if(op == OpAccept) {
+        onAccept(cqe);
+      }
+      else if(op == OpTimeout) {
+        timeoutArmed = false;
+        expireIdle();
+        armTimeout();
+      }
+      else if(op == OpDrain) {
+        beginDrain();
+      }
+      else if(op == OpCancelAccept) {
+        // Nothing to do; the accept's own completion says it has ended
+      }
+      else {
+        auto it = connections.find(fd);
+        if(it != connections.end()) {
+          Connection& conn = it->second;
+          bool last = !(cqe->flags & IORING_CQE_F_MORE);
+          if(op == OpRecv) {
+            onRecv(conn, cqe);
+          }
+          else if(op == OpSend || op == OpPoll) {
+            onSend(conn, op == OpSend ? cqe->res : 0);
+          }
+          if(last) {
+            opFinished(conn);
+          }
+        }
+      }
+      ring.cqeSeen();
+    }
+    ring.commitBuffers();
+  }
+}
+
+void UringLoop::onAccept(io_uring_cqe* cqe) {
+  if(!(cqe->flags & IORING_CQE_F_MORE) && !draining) {
+    armAccept();  // the multishot accept ended (e.g. out of fds); start a new one
+  }
+  if(cqe->res < 0) {
+    return;
+  }
+
+  // The multishot accept reports no address; admitConnection() asks for it when needed
+  int fd = cqe->res;
+  uint64_t acceptedNanos = monotonicNanos();
+  if(!admitConnection(fd)) {
+    return;
+  }
+  Connection& conn = connections.try_emplace(fd, fd, &arenaPool).first->second;
+  conn.lastActive = Clock::now();
+  conn.idlePos = idleList.insert(idleList.end(), fd);
+  metrics().connectionOpened(acceptedNanos);
+  armRecv(conn);
+}
+
+void UringLoop::onRecv(Connection& conn, io_uring_cqe* cqe) {
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if(!more) {
+    conn.recvArmed = false;
+    conn.recvCancelling = false;
+  }
+
+  if(cqe->res > 0) {
+    unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if(!conn.closeAfterWrite && !conn.closing) {
+      conn.in.append(ring.buffer(id), cqe->res);
+      if(!processRequests(conn.session, conn.in, conn.out, maxOutput)) {
+        conn.closeAfterWrite = true;
+      }
+    }
+    ring.recycleBuffer(id);
+
+    touch(conn);
+
+    startSend(conn);
+    if(conn.closing) {
+      return;
+    }
+    if(conn.session.outputFull) {
+      cancelRecv(conn);  // stop taking input until the client reads what is queued
+    }
+    else if(!conn.recvArmed && !conn.closeAfterWrite) {
+      armRecv(conn);
+    }
+    return;
+  }
+
+  if(cqe->res == -ENOBUFS || (cqe->res == -ECANCELED && !conn.closing)) {
+    // Every provided buffer was in use (they are recycled by now), or the receive was
+    // paused by the output cap; receive again unless it still applies
+    if(!more && !conn.closing && !conn.closeAfterWrite && !conn.session.outputFull) {
+      armRecv(conn);
+    }
+    return;
+  }
+
+  // Peer closed (0) or error: finish what is queued, then close
+  conn.closeAfterWrite = true;
+  if(cqe->res < 0 || (conn.out.empty() && !conn.session.outputFull)) {
+    closeConnection(conn);
+  }
+}
+
+void UringLoop::startSend(Connection& conn) {
+  while(!conn.sendInFlight && !conn.closing) {
+    if(conn.out.empty()) {
+      if(conn.session.outputFull) {
+        // The client caught up: handle what the output cap held back and receive again
+        if(!processRequests(conn.session, conn.in, conn.out, maxOutput)) {
+          conn.closeAfterWrite = true;
+        }
+        if(!conn.session.outputFull && !conn.recvArmed && !conn.closeAfterWrite) {
+          armRecv(conn);
+        }
+        continue;
+      }
+      if(conn.closeAfterWrite) {
+        closeConnection(conn);
+      }
+      return;
+    }
+
+    if(conn.outOffset == 0) {
+      conn.sendStart = monotonicNanos();
+    }
+    int count = gatherResponses(conn.out, conn.outOffset, conn.iov, kMaxWriteIov);
+    if(count > 0) {
+      // In-memory bytes of as many queued responses as fit go through the ring in one SENDMSG
+      conn.msg = msghdr{};
+      conn.msg.msg_iov = conn.iov;
+      conn.msg.msg_iovlen = count;
+      io_uring_sqe* sqe = prepare(OpSend, conn.fd);
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->addr = reinterpret_cast<unsigned long>(&conn.msg);
+      sqe->len = 1;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      conn.sendInFlight = true;
+      ++conn.pending;
+      return;
+    }
+
+    // File regions use sendfile() on the non-blocking socket; when the socket is
+    // full, a poll request on the ring tells us when to carry on
+    ssize_t nbytes = sendFileRegion(conn.fd, conn.out.front(), conn.outOffset);
+    if(nbytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if(nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      io_uring_sqe* sqe = prepare(OpPoll, conn.fd);
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->poll32_events = POLLOUT;
+      conn.sendInFlight = true;
+      ++conn.pending;
+      return;
+    }
+    if(nbytes <= 0) {
+      closeConnection(conn);  // socket error, or the file shrank underneath us
+      return;
+    }
+    advanceResponses(conn.out, conn.outOffset, nbytes, conn.sendStart, monotonicNanos());
+    touch(conn);
+  }
+}
+
+void UringLoop::onSend(Connection& conn, int res) {
+  conn.sendInFlight = false;
+  if(conn.closing) {
+    return;
+  }
+  if(res < 0) {
+    closeConnection(conn);
+    return;
+  }
+
+  if(res > 0) {
+    // A client that is still taking in a response is not idle
+    advanceResponses(conn.out, conn.outOffset, res, conn.sendStart, monotonicNanos());
+    touch(conn);
+  }
+  startSend(conn);
+}
+
+void UringLoop::touch(Connection& conn) {
+  conn.lastActive = Clock::now();
+  idleList.splice(idleList.end(), idleList, conn.idlePos);
+}
+
+void UringLoop::closeConnection(Connection& conn) {
+  if(conn.closing) {
+    return;
+  }
+  conn.closing = true;
+
+  // Stop the multishot receive; the descriptor is closed once every operation on it has completed
+  cancelRecv(conn);
+  if(conn.pending == 0) {
+    ++conn.pending;
+    opFinished(conn);
+  }
+}
+
+void UringLoop::opFinished(Connection& conn) {
+  --conn.pending;
+  if(conn.closing && conn.pending == 0) {
+    int fd = conn.fd;
+    idleList.erase(conn.idlePos);
+    connections.erase(fd);
+    close(fd);
+    metrics().connectionClosed();
+    admission().release();
+  }
+}
+
+void UringLoop::expireIdle() {
+  Clock::time_point now = Clock::now();
+  // Past the drain deadline every connection goes, however recently it was active
+  bool all = draining && now >= lifecycle().drainDeadline();
+  if(idleTimeout.count() > 0 || all) {
+    Clock::time_point cutoff = now - idleTimeout;
+    for(auto it = idleList.begin(); it != idleList.end();) {
+      Connection& conn = connections.at(*it);
+      ++it;  // closeConnection may erase the current entry
+      if(conn.lastActive > cutoff && !all) {
+        break;
+      }
+      closeConnection(conn);
+    }
+  }
+  if(draining) {
+    closeQuiet();
+  }
+}
+
+void UringLoop::beginDrain() {
+  draining = true;
+
+  // The pending accept holds its own reference to the socket, so it can be closed now
+  io_uring_sqe* sqe = prepare(OpCancelAccept, listenFd);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = tag(OpAccept, listenFd);
+  lifecycle().closeListener(listenFd);
+
+  // Tick once a second to enforce the deadline, even without an idle timeout
+  if(!timeoutArmed) {
+    armTimeout();
+  }
+
+  closeQuiet();
+}
+
+// While draining: close the connections with nothing in progress that have been quiet for
+// kDrainGrace. The rest close after their next response, or on a later tick.
+void UringLoop::closeQuiet() {
+  Clock::time_point cutoff = Clock::now() - kDrainGrace;
+  for(auto it = idleList.begin(); it != idleList.end();) {
+    Connection& conn = connections.at(*it);
+    ++it;  // closeConnection may erase the current entry
+    if(conn.lastActive > cutoff) {
+      break;
+    }
+    if(conn.in.empty() && conn.out.empty() && !conn.sendInFlight && !conn.session.upload &&
+       !conn.session.outputFull && clientIdle(conn.fd)) {
+      closeConnection(conn);
+    }
+  }
+}
+
+int runUringServer(const ServerConfig& config) {
+  std::vector<int> listen_fds;
+  for(unsigned i = 0; i < config.workers; ++i) {
+    int fd = lifecycle().openListener(config.port, config.backlog);
+    if(fd < 0) {
+      for(int opened : listen_fds) {
+        lifecycle().closeListener(opened);
+      }
+      return 1;
+    }
+    listen_fds.push_back(fd);
+  }
+
+  std::cout << "Waiting for clients to connect (" << config.workers << " io_uring workers)...\n";
+  lifecycle().serving();
+
+  std::vector<std::thread> threads;
+  for(unsigned i = 0; i < config.workers; ++i) {
+    threads.emplace_back([&config, &listen_fds, i]() {
+      if(config.pinCpus) {
+        pinCurrentThreadToCpu(i);
+      }
+      try {
+        UringLoop loop(config, listen_fds[i]);
+        loop.run();
+      }
+      catch(const std::exception& e) {
+        std::cerr << e.what() << "\n";
+      }
+    });
+  }
+
+  // Each loop closed its own socket when draining began; a loop that failed left it open
+  for(auto& t : threads) {
+    t.join();
+  }
+  for(int fd : listen_fds) {
+    lifecycle().closeListener(fd);
+  }
+  return 0;
+}
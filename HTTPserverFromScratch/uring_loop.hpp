@@ -0,0 +1,95 @@
+#ifndef URING_LOOP_HPP
+#define URING_LOOP_HPP
+
+#include <string>
+#include <deque>
+#include <list>
+#include <chrono>
+#include <unordered_map>
+#include <memory_resource>
+#include <sys/socket.h>
+#include "config.hpp"
+#include "server.hpp"
+#include "uring.hpp"
+
+// io_uring counterpart of EventLoop. One per worker thread, each with its own
+// SO_REUSEPORT listening socket and its own ring:
+//  - a single multishot accept keeps producing new connections,
+//  - every connection has one multishot receive that picks buffers from a
+//    provided buffer ring, so idle connections pin no receive memory,
+//  - all requests prepared while handling a batch of completions go to the
+//    kernel in one io_uring_enter() that also waits for the next batch.
+// Requests are handled by the same processRequests()/HttpResponse code as the
+// blocking and epoll paths. A connection whose queued output reaches the cap has its
+// receive cancelled until the responses are sent. When the server drains, the accept is
+// cancelled and the listening socket closed, and the loop returns once its connections
+// have finished.
+class UringLoop {
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Op { OpAccept = 1, OpRecv, OpSend, OpPoll, OpCancel, OpTimeout, OpDrain, OpCancelAccept };
+
+    struct Connection {
+      int fd;
+      std::string in;
+      HttpSession session;
+      std::deque<HttpResponse> out;
+      size_t outOffset = 0;
+      bool closeAfterWrite = false;
+      bool closing = false;
+      bool recvArmed = false;
+      bool recvCancelling = false; // an ASYNC_CANCEL for the receive has been submitted
+      bool sendInFlight = false;
+      uint64_t sendStart = 0;      // when writing out.front() began, for the send-phase metric
+      unsigned pending = 0;        // submitted operations whose last completion has not arrived
+      struct iovec iov[kMaxWriteIov];  // the SENDMSG in flight; must stay put until it completes
+      struct msghdr msg;
+      Clock::time_point lastActive;
+      std::list<int>::iterator idlePos;
+
+      Connection(int fd, std::pmr::memory_resource* upstream) : fd(fd), session(upstream) {}
+    };
+
+    IoUring ring;
+    int listenFd;                  // closed when draining begins
+    bool draining;
+    bool timeoutArmed;
+    std::chrono::seconds idleTimeout;
+    size_t maxOutput;              // per-connection cap on queued response bytes
+    __kernel_timespec tick;
+    std::pmr::unsynchronized_pool_resource arenaPool;  // upstream of the per-connection arenas
+    std::unordered_map<int, Connection> connections;
+    std::list<int> idleList;       // oldest activity first
+
+    io_uring_sqe* prepare(Op op, int fd);
+    void armAccept();
+    void armRecv(Connection& conn);
+    void cancelRecv(Connection& conn);
+    void armTimeout();
+
+    void onAccept(io_uring_cqe* cqe);
+    void onRecv(Connection& conn, io_uring_cqe* cqe);
+    void onSend(Connection& conn, int res);
+    void startSend(Connection& conn);
+    void touch(Connection& conn);
+    void closeConnection(Connection& conn);
+    void opFinished(Connection& conn);
+    void expireIdle();
+    void beginDrain();
+    void closeQuiet();
+
+  public:
+    UringLoop(const ServerConfig& config, int listen_fd);
+
+    UringLoop(const UringLoop&) = delete;
+    UringLoop& operator=(const UringLoop&) = delete;
+
+    // Process completions until the server drains and every connection has closed
+    void run();
+};
+
+// Start config.workers io_uring loops, each on its own SO_REUSEPORT socket
+int runUringServer(const ServerConfig& config);
+
+#endif // URING_LOOP_HPP
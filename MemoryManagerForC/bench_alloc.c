@@ -0,0 +1,89 @@
+// Allocation-heavy benchmark: throughput of a malloc/free churn on a working
+// set of short-lived blocks while the number of long-lived blocks in the heap
+// grows. With a linear free-block search the cost of each malloc grows with
+// the heap; with size-class lists it should stay flat.
+//
+// Build against the custom allocator:
+//   gcc -O2 -DMEM_MANAGER_NO_MAIN mem_manager.c bench_alloc.c -o bench_alloc -pthread
+// or against the system malloc for comparison:
+//   gcc -O2 bench_alloc.c -o bench_alloc_libc
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CHURN_OPS 200000
+#define WORKING_SET 1024
+#define BATCH 64
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Mostly small objects, with one in 16 between 1 KB and 8 KB
+static size_t random_size() {
+    uint64_t r = next_random();
+    if((r & 15) == 0) {
+        return 1024 + (r >> 8) % 7168;
+    }
+    return 16 + (r >> 8) % 496;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    static const size_t heap_sizes[] = {1000, 10000, 50000, 100000, 200000};
+    size_t count = sizeof(heap_sizes) / sizeof(heap_sizes[0]);
+    size_t max_live = heap_sizes[count - 1];
+    void** live = malloc(max_live * sizeof(void*));
+    void* working[WORKING_SET] = {0};
+    size_t n = 0, i, j, round;
+
+    printf("%12s %14s %14s %14s\n", "live blocks", "ops/sec", "malloc ns/op", "free ns/op");
+    for(i = 0; i < count; i++) {
+        double malloc_time = 0, free_time = 0, start;
+
+        while(n < heap_sizes[i]) {
+            live[n++] = malloc(random_size());
+        }
+
+        // Each round frees a batch of the working set and allocates new blocks
+        // in its place; the two halves are timed separately
+        for(round = 0; round < CHURN_OPS / BATCH; round++) {
+            size_t first = (next_random() % (WORKING_SET / BATCH)) * BATCH;
+
+            start = now_seconds();
+            for(j = first; j < first + BATCH; j++) {
+                free(working[j]);
+            }
+            free_time += now_seconds() - start;
+
+            start = now_seconds();
+            for(j = first; j < first + BATCH; j++) {
+                working[j] = malloc(random_size());
+            }
+            malloc_time += now_seconds() - start;
+        }
+        printf("%12zu %14.0f %14.1f %14.1f\n", n, 2 * CHURN_OPS / (malloc_time + free_time),
+               malloc_time * 1e9 / CHURN_OPS, free_time * 1e9 / CHURN_OPS);
+    }
+
+    for(i = 0; i < WORKING_SET; i++) {
+        free(working[i]);
+    }
+    for(i = 0; i < n; i++) {
+        free(live[i]);
+    }
+    free(live);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Worst-case free latency benchmark: with a growing number of live blocks
+// below them, blocks at the top of the heap are allocated and freed again, so
+// that frees keep shrinking the heap. If finding the new last block meant
+// walking the block list, those frees would cost time in proportion to the
+// heap; the maximum latency should instead stay flat.
+//
+// Build against the custom allocator:
+//   gcc -O2 -DMEM_MANAGER_NO_MAIN mem_manager.c bench_free.c -o bench_free -pthread
+// or against the system malloc for comparison:
+//   gcc -O2 bench_free.c -o bench_free_libc
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LIVE_BLOCK_SIZE 1040  // above the thread cache sizes, so frees reach the heap
+#define TOP_BLOCKS 64
+#define TOP_BLOCK_SIZE (8 * 1024)
+#define ROUNDS 200
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+    static const size_t heap_sizes[] = {1000, 10000, 50000, 100000};
+    size_t count = sizeof(heap_sizes) / sizeof(heap_sizes[0]);
+    size_t max_live = heap_sizes[count - 1];
+    void** live = malloc(max_live * sizeof(void*));
+    void* top[TOP_BLOCKS];
+    double* latencies = malloc(ROUNDS * TOP_BLOCKS * sizeof(double));
+    size_t samples = ROUNDS * TOP_BLOCKS;
+    size_t n = 0, i, j, round;
+
+    printf("%12s %12s %12s %12s %12s\n", "live blocks", "avg ns", "p50 ns", "p99 ns", "max ns");
+    for(i = 0; i < count; i++) {
+        double total = 0;
+
+        while(n < heap_sizes[i]) {
+            live[n++] = malloc(LIVE_BLOCK_SIZE);
+        }
+
+        // Freeing the top blocks from the last one down merges them into a
+        // free block at the top of the heap, which is given back every time
+        // it grows big enough
+        for(round = 0; round < ROUNDS; round++) {
+            for(j = 0; j < TOP_BLOCKS; j++) {
+                top[j] = malloc(TOP_BLOCK_SIZE);
+            }
+            for(j = TOP_BLOCKS; j-- > 0;) {
+                double start = now_ns();
+                free(top[j]);
+                latencies[round * TOP_BLOCKS + j] = now_ns() - start;
+                total += latencies[round * TOP_BLOCKS + j];
+            }
+        }
+
+        // A single core may be preempted in the middle of any free, so the
+        // percentiles are steadier than the maximum
+        qsort(latencies, samples, sizeof(double), compare_doubles);
+        printf("%12zu %12.0f %12.0f %12.0f %12.0f\n", n, total / samples, latencies[samples / 2],
+               latencies[samples * 99 / 100], latencies[samples - 1]);
+    }
+
+    for(i = 0; i < n; i++) {
+        free(live[i]);
+    }
+    free(live);
+    free(latencies);
+    return 0;
+}
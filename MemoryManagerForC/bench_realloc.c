@@ -0,0 +1,70 @@
+// Append benchmark: buffers grown a few bytes at a time with realloc, as a
+// string builder or a vector that grows by one element would. Every time
+// realloc has to move a buffer it copies everything appended so far, so the
+// cost per append depends on how often a buffer can grow in place.
+//   single:      one buffer grows to 1 MB
+//   interleaved: 8 buffers take turns growing to 256 KB each, so each is
+//                hemmed in by the others
+// Reports the time per append and how many appends moved the buffer.
+//
+// Build against the custom allocator:
+//   gcc -O2 -DMEM_MANAGER_NO_MAIN mem_manager.c bench_realloc.c -o bench_realloc -pthread
+// or against the system malloc for comparison:
+//   gcc -O2 bench_realloc.c -o bench_realloc_libc
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define APPEND_SIZE 16
+#define ROUNDS 10
+#define MAX_BUFFERS 8
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Grow buffers buffers to final_size bytes each, APPEND_SIZE bytes at a time
+static void run(const char* name, int buffers, size_t final_size) {
+    char* data[MAX_BUFFERS];
+    size_t length, appends = 0, moves = 0;
+    double start, elapsed = 0;
+    int round, i;
+
+    for(round = 0; round < ROUNDS; round++) {
+        memset(data, 0, sizeof(data));
+        start = now_seconds();
+        for(length = APPEND_SIZE; length <= final_size; length += APPEND_SIZE) {
+            for(i = 0; i < buffers; i++) {
+                char* grown = realloc(data[i], length);
+                if(!grown) {
+                    fprintf(stderr, "realloc failed\n");
+                    exit(1);
+                }
+                if(grown != data[i] && data[i]) {
+                    moves++;
+                }
+                memset(grown + length - APPEND_SIZE, 'a' + i, APPEND_SIZE);
+                data[i] = grown;
+                appends++;
+            }
+        }
+        elapsed += now_seconds() - start;
+        for(i = 0; i < buffers; i++) {
+            free(data[i]);
+        }
+    }
+
+    printf("%-12s %12.1f %12zu %12.4f\n", name, elapsed * 1e9 / appends, moves / ROUNDS,
+           (double)moves / appends);
+}
+
+int main() {
+    printf("%-12s %12s %12s %12s\n", "pattern", "ns/append", "moves", "moves/append");
+    run("single", 1, 1024 * 1024);
+    run("interleaved", MAX_BUFFERS, 256 * 1024);
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Multi-threaded allocation benchmark: malloc/free throughput with 1 to N
+// threads, in two patterns.
+//   local:    each thread frees and reallocates blocks of its own working set
+//   transfer: threads work in pairs; one allocates and passes each block
+//             through a queue to the other, which frees it
+// With a single allocator lock throughput drops as threads are added; with
+// per-thread caches it should scale with the cores available.
+//
+// Build against the custom allocator:
+//   gcc -O2 -DMEM_MANAGER_NO_MAIN mem_manager.c bench_threads.c -o bench_threads -pthread
+// or against the system malloc for comparison:
+//   gcc -O2 bench_threads.c -o bench_threads_libc -pthread
+// Run with the largest thread count as the argument (default 8).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define OPS_PER_THREAD 1000000
+#define WORKING_SET 256
+#define QUEUE_SIZE 1024  // power of two
+
+// Single-producer, single-consumer ring of blocks
+typedef struct queue {
+    _Atomic size_t head;  // next slot the consumer reads
+    char pad1[64 - sizeof(size_t)];
+    _Atomic size_t tail;  // next slot the producer writes
+    char pad2[64 - sizeof(size_t)];
+    void* slots[QUEUE_SIZE];
+} queue_t;
+
+typedef struct worker {
+    pthread_t thread;
+    uint64_t rng;
+    queue_t* queue;
+} worker_t;
+
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static size_t random_size(uint64_t* state) {
+    return 16 + next_random(state) % 496;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* local_worker(void* arg) {
+    worker_t* w = arg;
+    void* working[WORKING_SET] = {0};
+    size_t op, i;
+
+    // Each op is one free and one malloc
+    for(op = 0; op < OPS_PER_THREAD / 2; op++) {
+        i = next_random(&w->rng) % WORKING_SET;
+        free(working[i]);
+        working[i] = malloc(random_size(&w->rng));
+    }
+    for(i = 0; i < WORKING_SET; i++) {
+        free(working[i]);
+    }
+    return NULL;
+}
+
+static void* producer(void* arg) {
+    worker_t* w = arg;
+    queue_t* q = w->queue;
+    size_t n;
+
+    for(n = 0; n < OPS_PER_THREAD / 2; n++) {
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        void* block = malloc(random_size(&w->rng));
+        while(tail - atomic_load_explicit(&q->head, memory_order_acquire) == QUEUE_SIZE) {
+            sched_yield();
+        }
+        q->slots[tail % QUEUE_SIZE] = block;
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void* consumer(void* arg) {
+    worker_t* w = arg;
+    queue_t* q = w->queue;
+    size_t n;
+
+    for(n = 0; n < OPS_PER_THREAD / 2; n++) {
+        size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        while(atomic_load_explicit(&q->tail, memory_order_acquire) == head) {
+            sched_yield();
+        }
+        free(q->slots[head % QUEUE_SIZE]);
+        atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+// Run threads workers (pairs of producer and consumer if transfer is set)
+// and return operations per second over all of them
+static double run(int threads, int transfer) {
+    worker_t* workers = calloc(threads, sizeof(worker_t));
+    queue_t* queues = calloc(threads / 2 + 1, sizeof(queue_t));
+    double start, elapsed;
+    int i;
+
+    start = now_seconds();
+    for(i = 0; i < threads; i++) {
+        workers[i].rng = 88172645463325252ULL + i * 7919;
+        workers[i].queue = &queues[i / 2];
+        if(transfer) {
+            pthread_create(&workers[i].thread, NULL, i % 2 ? consumer : producer, &workers[i]);
+        }
+        else {
+            pthread_create(&workers[i].thread, NULL, local_worker, &workers[i]);
+        }
+    }
+    for(i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = now_seconds() - start;
+
+    free(queues);
+    free(workers);
+    return (double)threads * OPS_PER_THREAD / elapsed;
+}
+
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    int threads;
+
+    printf("%8s %16s %16s\n", "threads", "local ops/sec", "transfer ops/sec");
+    for(threads = 1; threads <= max_threads; threads *= 2) {
+        double local = run(threads, 0);
+        if(threads >= 2) {
+            printf("%8d %16.0f %16.0f\n", threads, local, run(threads, 1));
+        }
+        else {
+            printf("%8d %16.0f %16s\n", threads, local, "-");
+        }
+    }
+    return 0;
+}
@@ -1,101 +1,560 @@
+#define _GNU_SOURCE  // mremap
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include "mem_manager.h"
 
+// Every block size is rounded up to a multiple of this
+#define ALIGNMENT 16
+#define ALIGN_UP(n) (((n) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Free blocks are kept in segregated lists by size class. Up to SMALL_LIMIT
+// there is one class per ALIGNMENT step, so every block in a small class has
+// exactly the size asked for and malloc just takes the first one. Above it a
+// class covers a power of two ([1024, 2048), [2048, 4096), ...) and is searched
+// for the best fit.
+#define SMALL_LIMIT 1024
+#define SMALL_CLASSES (SMALL_LIMIT / ALIGNMENT)
+#define LARGE_CLASSES (64 - 10)  // log2(SMALL_LIMIT) = 10
+#define NUM_CLASSES (SMALL_CLASSES + LARGE_CLASSES)
+
+// A free block's payload holds its links in the list of its size class
+typedef struct free_links {
+    header_t* prev;
+    header_t* next;
+} free_links_t;
+
+#define LINKS(header) ((free_links_t*)((header) + 1))
+
+// Header and footer of every block
+#define BLOCK_OVERHEAD (sizeof(header_t) + sizeof(footer_t))
+
+// A free block is only split if the rest can hold a block of its own
+#define MIN_SPLIT (BLOCK_OVERHEAD + ALIGNMENT)
+
+#define FOOTER(header) ((footer_t*)((char*)((header) + 1) + (header)->s.size))
+#define BLOCK_END(header) ((char*)FOOTER(header) + sizeof(footer_t))
+
+// The heap grows by multiples of HEAP_CHUNK, and a free block of at least
+// TRIM_THRESHOLD at the top of it is given back to the OS
+#define HEAP_CHUNK (128 * 1024)
+#define TRIM_THRESHOLD (256 * 1024)
+
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+
+// A mapped block's header starts this far into its mapping, so its payload
+// is aligned like those in the heap
+#define MMAP_OFFSET ((ALIGNMENT - sizeof(header_t) % ALIGNMENT) % ALIGNMENT)
+
 // Global variables
 header_t* head = NULL, *tail = NULL;
+char* heap_start = NULL;  // the break before the first block, when there is one
 pthread_mutex_t global_malloc_lock = PTHREAD_MUTEX_INITIALIZER;
 
+header_t* free_lists[NUM_CLASSES];
+uint64_t free_list_map[(NUM_CLASSES + 63) / 64];  // bit set for each non-empty class
+
+// Read without the lock on every allocation and may be changed at any time, so atomic
+_Atomic size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+
+// Bytes taken from the OS (with sbrk or mmap, the latter also counted in
+// mapped_bytes) and bytes handed out to callers, with their high-water marks,
+// for the fragmentation figures in print_mem_list()
+size_t heap_bytes, peak_heap_bytes, mapped_bytes;
+size_t live_bytes, peak_live_bytes;
+
+static size_t size_class(size_t size) {
+    if(size <= SMALL_LIMIT) {
+        return size / ALIGNMENT - 1;
+    }
+    return SMALL_CLASSES + (63 - __builtin_clzll(size)) - 10;
+}
+
+// First class at or above cls that has a free block, or NUM_CLASSES if none
+static size_t next_nonempty_class(size_t cls) {
+    while(cls < NUM_CLASSES) {
+        uint64_t bits = free_list_map[cls / 64] >> (cls % 64);
+        if(bits) {
+            return cls + __builtin_ctzll(bits);
+        }
+        cls = (cls / 64 + 1) * 64;
+    }
+    return NUM_CLASSES;
+}
+
+static void free_list_insert(header_t* header) {
+    size_t cls = size_class(header->s.size);
+    LINKS(header)->prev = NULL;
+    LINKS(header)->next = free_lists[cls];
+    if(free_lists[cls]) {
+        LINKS(free_lists[cls])->prev = header;
+    }
+    free_lists[cls] = header;
+    free_list_map[cls / 64] |= (uint64_t)1 << (cls % 64);
+}
+
+static void free_list_remove(header_t* header) {
+    size_t cls = size_class(header->s.size);
+    if(LINKS(header)->prev) {
+        LINKS(LINKS(header)->prev)->next = LINKS(header)->next;
+    }
+    else {
+        free_lists[cls] = LINKS(header)->next;
+        if(!free_lists[cls]) {
+            free_list_map[cls / 64] &= ~((uint64_t)1 << (cls % 64));
+        }
+    }
+    if(LINKS(header)->next) {
+        LINKS(LINKS(header)->next)->prev = LINKS(header)->prev;
+    }
+}
+
+static void set_size(header_t* header, size_t size) {
+    header->s.size = size;
+    *FOOTER(header) = size;
+}
+
+// The block physically before header, found through its footer
+static header_t* prev_block(header_t* header) {
+    footer_t size = *((footer_t*)header - 1);
+    return (header_t*)((char*)header - sizeof(footer_t) - size) - 1;
+}
+
+// Cut header down to size bytes and return the rest as an in-use block of
+// its own. The rest must have room for a block.
+static header_t* carve_block(header_t* header, size_t size) {
+    header_t* rest = (header_t*)((char*)(header + 1) + size + sizeof(footer_t));
+
+    set_size(rest, header->s.size - size - BLOCK_OVERHEAD);
+    rest->s.is_free = 0;
+    rest->s.is_mmapped = 0;
+    rest->s.next = header->s.next;
+    header->s.next = rest;
+    if(tail == header) {
+        tail = rest;
+    }
+    set_size(header, size);
+    return rest;
+}
+
+// Cut header down to size bytes if enough is left over for another block,
+// which goes back on the free lists
+static void split_block(header_t* header, size_t size) {
+    header_t* rest;
+
+    if(header->s.size < size + MIN_SPLIT) {
+        return;
+    }
+
+    rest = carve_block(header, size);
+    rest->s.is_free = 1;
+    free_list_insert(rest);
+}
+
+// Take a free block of at least size bytes (already aligned) off its list.
+// Small sizes look in their exact class first. Large sizes take the best fit
+// within their own class. Failing that, the first block of the next non-empty
+// class is always big enough, and is split down to size.
 header_t* get_free_block(size_t size) {
-    header_t* curr = head;
-    while(curr) {
-        if(curr->s.is_free && curr->s.size >= size) {
-            return curr;
+    size_t cls = size_class(size);
+    header_t* best = NULL, *curr;
+
+    if(cls < SMALL_CLASSES) {
+        best = free_lists[cls];
+    }
+    else {
+        for(curr = free_lists[cls]; curr; curr = LINKS(curr)->next) {
+            if(curr->s.size >= size && (!best || curr->s.size < best->s.size)) {
+                best = curr;
+                if(curr->s.size == size) {
+                    break;
+                }
+            }
+        }
+    }
+    if(!best) {
+        cls = next_nonempty_class(cls + 1);
+        if(cls < NUM_CLASSES) {
+            best = free_lists[cls];
         }
-        curr = curr->s.next;
     }
 
-    return NULL;
+    if(best) {
+        free_list_remove(best);
+        split_block(best, size);
+    }
+    return best;
 }
 
-void* malloc(size_t size) {
-    size_t total_size;
+static void count_live(size_t bytes) {
+    live_bytes += bytes;
+    if(live_bytes > peak_live_bytes) {
+        peak_live_bytes = live_bytes;
+    }
+}
+
+// Take an in-use block of at least size bytes (already aligned) from the
+// heap, growing it if needed. Called with global_malloc_lock held.
+static header_t* heap_alloc(size_t size) {
+    size_t total_size, pad = 0;
     void* block;
     header_t* header;
 
-    if(!size) {
-        return NULL;
-    }
-
-    pthread_mutex_lock(&global_malloc_lock);
     header = get_free_block(size);
     if(header) {
         header->s.is_free = 0;
-        pthread_mutex_unlock(&global_malloc_lock);
-        return (void*)(header + 1);
+        return header;
     }
 
-    total_size = sizeof(header_t) + size;
+    // Grow the heap by whole chunks, so most allocations need no system call.
+    // A free block at the top is extended rather than left behind.
+    if(tail && tail->s.is_free) {
+        total_size = size - tail->s.size;
+    }
+    else {
+        total_size = BLOCK_OVERHEAD + size;
+    }
+    total_size = (total_size + HEAP_CHUNK - 1) / HEAP_CHUNK * HEAP_CHUNK;
+
+    // The first block starts 8 bytes past a 16-byte boundary (see header_t)
+    if(!tail) {
+        pad = (sizeof(header_t) - (uintptr_t)sbrk(0)) % ALIGNMENT;
+        total_size += pad;
+    }
     block = sbrk(total_size);
     if(block == (void*) - 1) {
-        pthread_mutex_unlock(&global_malloc_lock);
         return NULL;
     }
 
-    header = block;
-    header->s.size = size;
-    header->s.is_free = 0;
-    header->s.next = NULL;
+    // Neighbours are found by address, so the heap must stay contiguous. If
+    // something else moved the break, give the memory back.
+    if(tail && (char*)block != BLOCK_END(tail)) {
+        sbrk(0 - total_size);
+        return NULL;
+    }
 
-    if(!head) {
-        head = header;
+    heap_bytes += total_size;
+    if(heap_bytes > peak_heap_bytes) {
+        peak_heap_bytes = heap_bytes;
     }
 
-    if(tail) {
-        tail->s.next = header;
+    if(tail && tail->s.is_free) {
+        header = tail;
+        free_list_remove(header);
+        set_size(header, header->s.size + total_size);
     }
+    else {
+        if(!tail) {
+            heap_start = block;
+        }
+        header = (header_t*)((char*)block + pad);
+        set_size(header, total_size - pad - BLOCK_OVERHEAD);
+        header->s.is_mmapped = 0;
+        header->s.next = NULL;
 
-    tail = header;
-    pthread_mutex_unlock(&global_malloc_lock);
+        if(!head) {
+            head = header;
+        }
+
+        if(tail) {
+            tail->s.next = header;
+        }
+
+        tail = header;
+    }
 
-    return (void*)(header + 1);
+    header->s.is_free = 0;
+    split_block(header, size);
+    return header;
 }
 
-void free(void* block) {
-    header_t* header, *temp;
+// Return a block to the heap: merge it with free neighbours, then give it
+// back to the OS if it ends at the program break and is big enough to be
+// worth it, or else put it on the free lists. Called with global_malloc_lock
+// held.
+static void heap_free(header_t* header) {
+    header_t* neighbour;
     void* program_break;
+    size_t release;
 
-    if(!block) {
-        return;
+    header->s.is_free = 1;
+
+    // Free blocks are always merged with free neighbours, so there is at most
+    // one on each side to absorb
+    if(header != tail) {
+        neighbour = header->s.next;
+        if(neighbour->s.is_free) {
+            free_list_remove(neighbour);
+            header->s.next = neighbour->s.next;
+            if(tail == neighbour) {
+                tail = header;
+            }
+            set_size(header, header->s.size + BLOCK_OVERHEAD + neighbour->s.size);
+        }
+    }
+    if(header != head) {
+        neighbour = prev_block(header);
+        if(neighbour->s.is_free) {
+            free_list_remove(neighbour);
+            neighbour->s.next = header->s.next;
+            if(tail == header) {
+                tail = neighbour;
+            }
+            set_size(neighbour, neighbour->s.size + BLOCK_OVERHEAD + header->s.size);
+            header = neighbour;
+        }
     }
 
-    pthread_mutex_lock(&global_malloc_lock);
-    header = (header_t*)block - 1;
     program_break = sbrk(0);
-
-    if((char*)block + header->s.size == program_break) {
+    if(BLOCK_END(header) == program_break && header->s.size >= TRIM_THRESHOLD) {
+        release = BLOCK_OVERHEAD + header->s.size;
         if(head == tail) {
+            release = (char*)program_break - heap_start;
             head = tail = NULL;
         }
         else {
-            temp = head;
-            while(temp) {
-                if(temp->s.next == tail) {
-                    temp->s.next = NULL;
-                    tail = temp;
-                }
-                temp = temp->s.next;
-            }
+            // next links the blocks forwards and footers link them backwards,
+            // so the new last block is found without walking the list
+            tail = prev_block(header);
+            tail->s.next = NULL;
+        }
+
+        sbrk(0 - release);
+        heap_bytes -= release;
+        return;
+    }
+
+    free_list_insert(header);
+}
+
+static size_t page_size() {
+    static size_t size;
+    if(!size) {
+        size = sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+// Length of the mapping holding a block of size bytes
+static size_t mapping_length(size_t size) {
+    size_t page = page_size();
+    return (MMAP_OFFSET + BLOCK_OVERHEAD + size + page - 1) & ~(page - 1);
+}
+
+// A block of at least size bytes in a mapping of its own. Its size takes up
+// the whole mapping, rounded down to ALIGNMENT.
+static header_t* mmap_alloc(size_t size) {
+    size_t length = mapping_length(size);
+    char* base;
+    header_t* header;
+
+    base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = (header_t*)(base + MMAP_OFFSET);
+    set_size(header, (length - MMAP_OFFSET - BLOCK_OVERHEAD) & ~(size_t)(ALIGNMENT - 1));
+    header->s.is_free = 0;
+    header->s.is_mmapped = 1;
+    header->s.next = NULL;
+
+    pthread_mutex_lock(&global_malloc_lock);
+    heap_bytes += length;
+    mapped_bytes += length;
+    if(heap_bytes > peak_heap_bytes) {
+        peak_heap_bytes = heap_bytes;
+    }
+    count_live(header->s.size);
+    pthread_mutex_unlock(&global_malloc_lock);
+    return header;
+}
+
+static void mmap_free(header_t* header) {
+    size_t length = mapping_length(header->s.size);
+
+    pthread_mutex_lock(&global_malloc_lock);
+    heap_bytes -= length;
+    mapped_bytes -= length;
+    live_bytes -= header->s.size;
+    pthread_mutex_unlock(&global_malloc_lock);
+
+    munmap((char*)header - MMAP_OFFSET, length);
+}
+
+void set_mmap_threshold(size_t threshold) {
+    atomic_store_explicit(&mmap_threshold, threshold, memory_order_relaxed);
+}
+
+// Thread caches. Each thread keeps its own lists of small blocks, one per
+// small size class, and malloc and free use them without taking
+// global_malloc_lock. An empty list is refilled with TCACHE_BATCH blocks
+// under a single lock; a list that grows past TCACHE_MAX (say, in a thread
+// that frees what another allocated) hands TCACHE_BATCH back the same way.
+// Cached blocks stay marked in use, so the heap never merges them, and they
+// count as live. A thread's cache is returned to the heap when it exits.
+#define TCACHE_BATCH 16
+#define TCACHE_MAX 64
+
+typedef struct tcache {
+    header_t* lists[SMALL_CLASSES];  // linked through LINKS(block)->next
+    unsigned counts[SMALL_CLASSES];
+    int registered;                  // the exit destructor is set for this thread
+} tcache_t;
+
+__thread tcache_t tcache;
+pthread_key_t tcache_key;
+pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+static void tcache_push(size_t cls, header_t* header) {
+    LINKS(header)->next = tcache.lists[cls];
+    tcache.lists[cls] = header;
+    tcache.counts[cls]++;
+}
+
+static header_t* tcache_pop(size_t cls) {
+    header_t* header = tcache.lists[cls];
+    tcache.lists[cls] = LINKS(header)->next;
+    tcache.counts[cls]--;
+    return header;
+}
+
+// Return up to count blocks of a class to the heap
+static void tcache_flush(size_t cls, unsigned count) {
+    pthread_mutex_lock(&global_malloc_lock);
+    while(count-- && tcache.lists[cls]) {
+        header_t* header = tcache_pop(cls);
+        live_bytes -= header->s.size;
+        heap_free(header);
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+}
+
+static void tcache_destroy(void* unused) {
+    size_t cls;
+    (void)unused;
+
+    for(cls = 0; cls < SMALL_CLASSES; cls++) {
+        tcache_flush(cls, tcache.counts[cls]);
+    }
+    // Freeing in a later destructor fills the cache again and registers anew
+    tcache.registered = 0;
+}
+
+static void tcache_create_key() {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+// Fill an empty class list with up to TCACHE_BATCH blocks: free blocks of the
+// class first, then one heap block carved into as many as are still missing
+static void tcache_refill(size_t cls) {
+    size_t size = (cls + 1) * ALIGNMENT;
+    unsigned missing = TCACHE_BATCH;
+    header_t* header, *rest;
+
+    pthread_mutex_lock(&global_malloc_lock);
+    while(missing && free_lists[cls]) {
+        header = free_lists[cls];
+        free_list_remove(header);
+        header->s.is_free = 0;
+        count_live(header->s.size);
+        tcache_push(cls, header);
+        missing--;
+    }
+    if(missing) {
+        header = heap_alloc(missing * (size + BLOCK_OVERHEAD) - BLOCK_OVERHEAD);
+        if(!header && missing == TCACHE_BATCH) {
+            header = heap_alloc(size);
+        }
+        while(header) {
+            rest = header->s.size >= size + MIN_SPLIT ? carve_block(header, size) : NULL;
+            count_live(header->s.size);
+            tcache_push(cls, header);
+            header = rest;
+        }
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+
+    if(!tcache.registered) {
+        pthread_once(&tcache_key_once, tcache_create_key);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = 1;
+    }
+}
+
+// malloc itself. calloc calls this rather than malloc: at -O2 compilers turn
+// malloc followed by memset into a call to calloc, which here would recurse.
+static void* allocate(size_t size) {
+    size_t cls;
+    header_t* header;
+
+    if(!size || size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = ALIGN_UP(size);
+
+    if(size <= SMALL_LIMIT) {
+        cls = size_class(size);
+        if(!tcache.lists[cls]) {
+            tcache_refill(cls);
+        }
+        if(tcache.lists[cls]) {
+            return (void*)(tcache_pop(cls) + 1);
+        }
+    }
+    else if(size <= atomic_load_explicit(&mmap_threshold, memory_order_relaxed)) {
+        pthread_mutex_lock(&global_malloc_lock);
+        header = heap_alloc(size);
+        if(header) {
+            count_live(header->s.size);
         }
-        
-        sbrk(0 - (sizeof(header_t) + header->s.size));
         pthread_mutex_unlock(&global_malloc_lock);
+        if(header) {
+            return (void*)(header + 1);
+        }
+    }
+
+    // Large blocks, and any the heap could not provide
+    header = mmap_alloc(size);
+    return header ? (void*)(header + 1) : NULL;
+}
+
+void* malloc(size_t size) {
+    return allocate(size);
+}
+
+void free(void* block) {
+    header_t* header;
+    size_t cls;
+
+    if(!block) {
         return;
     }
 
-    header->s.is_free = 1;
+    // The size of a block in use never changes under its owner, so it can be
+    // read without the lock
+    header = (header_t*)block - 1;
+    if(header->s.is_mmapped) {
+        mmap_free(header);
+        return;
+    }
+    if(header->s.size <= SMALL_LIMIT) {
+        cls = size_class(header->s.size);
+        tcache_push(cls, header);
+        if(tcache.counts[cls] > TCACHE_MAX) {
+            tcache_flush(cls, TCACHE_BATCH);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&global_malloc_lock);
+    live_bytes -= header->s.size;
+    heap_free(header);
     pthread_mutex_unlock(&global_malloc_lock);
 }
 
@@ -112,29 +571,139 @@ void* calloc(size_t num, size_t nSize) {
         return NULL;
     }
 
-    block = malloc(size);
+    block = allocate(size);
     if(!block) {
         return NULL;
     }
 
-    memset(block, 0, size);
+    // A fresh mapping is already zeroed
+    if(!((header_t*)block - 1)->s.is_mmapped) {
+        memset(block, 0, size);
+    }
     
     return block;
 }
 
+// Resize a mapped block with mremap, which moves it only if the mapping
+// cannot grow where it is. Returns the block's new header, or NULL if it
+// could not be resized.
+static header_t* resize_mapped(header_t* header, size_t size) {
+    size_t old_length = mapping_length(header->s.size), length = mapping_length(size);
+    size_t old_size = header->s.size;
+    char* base;
+
+    if(length == old_length) {
+        return header;
+    }
+    base = mremap((char*)header - MMAP_OFFSET, old_length, length, MREMAP_MAYMOVE);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = (header_t*)(base + MMAP_OFFSET);
+    set_size(header, (length - MMAP_OFFSET - BLOCK_OVERHEAD) & ~(size_t)(ALIGNMENT - 1));
+
+    pthread_mutex_lock(&global_malloc_lock);
+    heap_bytes = heap_bytes - old_length + length;
+    mapped_bytes = mapped_bytes - old_length + length;
+    if(heap_bytes > peak_heap_bytes) {
+        peak_heap_bytes = heap_bytes;
+    }
+    live_bytes -= old_size;
+    count_live(header->s.size);
+    pthread_mutex_unlock(&global_malloc_lock);
+    return header;
+}
+
+// Resize a heap block without moving it. Shrinking splits off the surplus
+// and frees it. Growing takes in the next block if that is free, and moves
+// the program break if the block is (then) the last one. Returns 1 if the
+// block now holds size bytes (already aligned). Called with
+// global_malloc_lock held.
+static int resize_in_place(header_t* header, size_t size) {
+    size_t old_size = header->s.size, grow;
+    header_t* next;
+    void* block;
+
+    if(size > header->s.size && header != tail) {
+        next = header->s.next;
+        if(next->s.is_free) {
+            free_list_remove(next);
+            header->s.next = next->s.next;
+            if(tail == next) {
+                tail = header;
+            }
+            set_size(header, header->s.size + BLOCK_OVERHEAD + next->s.size);
+        }
+    }
+
+    if(size > header->s.size && header == tail && BLOCK_END(header) == sbrk(0)) {
+        grow = (size - header->s.size + HEAP_CHUNK - 1) / HEAP_CHUNK * HEAP_CHUNK;
+        block = sbrk(grow);
+        if(block != (void*) - 1) {
+            if((char*)block == BLOCK_END(header)) {
+                set_size(header, header->s.size + grow);
+                heap_bytes += grow;
+                if(heap_bytes > peak_heap_bytes) {
+                    peak_heap_bytes = heap_bytes;
+                }
+            }
+            else {
+                sbrk(0 - grow);
+            }
+        }
+    }
+
+    // Whatever was taken in beyond size, or cut off by shrinking, goes back.
+    // (A block that could not grow enough keeps what it took in; the caller
+    // frees all of it once the contents are copied.)
+    if(size <= header->s.size && header->s.size >= size + MIN_SPLIT) {
+        heap_free(carve_block(header, size));
+    }
+
+    live_bytes -= old_size;
+    count_live(header->s.size);
+    return size <= header->s.size;
+}
+
 void* realloc(void* block, size_t size) {
     header_t* header;
     void* ret;
+    int resized;
 
     if(!block || !size) {
         return malloc(size);
     }
+    if(size > SIZE_MAX / 2) {
+        return NULL;
+    }
 
     header = (header_t*)block - 1;
-    if(header->s.size >= size) {
+    size = ALIGN_UP(size);
+
+    if(header->s.is_mmapped) {
+        header = resize_mapped(header, size);
+        if(header) {
+            return (void*)(header + 1);
+        }
+    }
+    else if(size > header->s.size || header->s.size >= size + MIN_SPLIT) {
+        pthread_mutex_lock(&global_malloc_lock);
+        resized = resize_in_place(header, size);
+        pthread_mutex_unlock(&global_malloc_lock);
+        if(resized) {
+            return block;
+        }
+    }
+    else {
         return block;
     }
 
+    // Could not resize in place: move it
+    header = (header_t*)block - 1;
+    if(header->s.size >= size) {
+        return block;
+    }
     ret = malloc(size);
     if(ret) {
         memcpy(ret, block, header->s.size);
@@ -144,16 +713,158 @@ void* realloc(void* block, size_t size) {
     return ret;
 }
 
+// Fixed-size object pools (see mem_manager.h). Each slab starts with a
+// cache line holding its link in the pool's slab list, followed by objects.
+// A new slab is not threaded onto the free list up front: objects are cut
+// from its unused part as needed, so its pages are only touched when used.
+#define CACHE_LINE 64
+#define SLAB_MIN_OBJECTS 8
+
+typedef struct slab {
+    struct slab* next;
+} slab_t;
+
+struct mem_pool {
+    size_t object_size;
+    size_t slab_size;
+    void* free_objects;  // each holds a pointer to the next
+    char* unused;        // the part of the newest slab no object was cut from yet
+    char* unused_end;
+    slab_t* slabs;
+};
+
+static void count_slab(long long bytes) {
+    pthread_mutex_lock(&global_malloc_lock);
+    heap_bytes += bytes;
+    mapped_bytes += bytes;
+    if(heap_bytes > peak_heap_bytes) {
+        peak_heap_bytes = heap_bytes;
+    }
+    live_bytes += bytes;
+    if(live_bytes > peak_live_bytes) {
+        peak_live_bytes = live_bytes;
+    }
+    pthread_mutex_unlock(&global_malloc_lock);
+}
+
+mem_pool_t* pool_create(size_t size) {
+    mem_pool_t* pool;
+    size_t page = page_size(), object_size = sizeof(void*);
+
+    if(!size || size > SIZE_MAX / (2 * SLAB_MIN_OBJECTS)) {
+        return NULL;
+    }
+
+    if(size <= CACHE_LINE) {
+        while(object_size < size) {
+            object_size *= 2;
+        }
+    }
+    else {
+        // Whole lines, unless that would waste more than an eighth
+        object_size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+        if(object_size - size > size / 8) {
+            object_size = ALIGN_UP(size);
+        }
+    }
+
+    pool = malloc(sizeof(mem_pool_t));
+    if(!pool) {
+        return NULL;
+    }
+    pool->object_size = object_size;
+    pool->slab_size = (CACHE_LINE + SLAB_MIN_OBJECTS * object_size + page - 1) & ~(page - 1);
+    if(pool->slab_size < page) {
+        pool->slab_size = page;
+    }
+    pool->free_objects = NULL;
+    pool->unused = pool->unused_end = NULL;
+    pool->slabs = NULL;
+    return pool;
+}
+
+void* pool_alloc(mem_pool_t* pool) {
+    void* object = pool->free_objects;
+    slab_t* slab;
+
+    if(object) {
+        pool->free_objects = *(void**)object;
+        return object;
+    }
+
+    if(pool->unused == pool->unused_end) {
+        slab = mmap(NULL, pool->slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(slab == MAP_FAILED) {
+            return NULL;
+        }
+        count_slab(pool->slab_size);
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->unused = (char*)slab + CACHE_LINE;
+        pool->unused_end = pool->unused + (pool->slab_size - CACHE_LINE) / pool->object_size * pool->object_size;
+    }
+
+    object = pool->unused;
+    pool->unused += pool->object_size;
+    return object;
+}
+
+void pool_free(mem_pool_t* pool, void* object) {
+    if(!object) {
+        return;
+    }
+    *(void**)object = pool->free_objects;
+    pool->free_objects = object;
+}
+
+void pool_destroy(mem_pool_t* pool) {
+    slab_t* slab, *next;
+
+    if(!pool) {
+        return;
+    }
+    for(slab = pool->slabs; slab; slab = next) {
+        next = slab->next;
+        munmap(slab, pool->slab_size);
+        count_slab(-(long long)pool->slab_size);
+    }
+    free(pool);
+}
+
 void print_mem_list() {
     header_t* current = head;
+    size_t heap, peak_heap, mapped, live, peak_live;
+    struct rusage usage;
+
+    pthread_mutex_lock(&global_malloc_lock);
+    heap = heap_bytes;
+    peak_heap = peak_heap_bytes;
+    mapped = mapped_bytes;
+    live = live_bytes;
+    peak_live = peak_live_bytes;
+    pthread_mutex_unlock(&global_malloc_lock);
+
     printf("head = %p, tail = %p\n", (void*)head, (void*)tail);
 
     while(current) {
         printf("addr = %p, size = %zu, is_free = %u, next = %p\n", (void*)current, current->s.size, current->s.is_free, (void*)current->s.next);
         current = current->s.next;
     }
+
+    // Fragmentation: how much of the memory taken from the OS is not holding
+    // live data, now and at the high-water marks
+    printf("live = %zu bytes (peak %zu), heap = %zu bytes (peak %zu), %zu of it mapped\n", live, peak_live, heap, peak_heap, mapped);
+    printf("fragmentation = %.1f%%, peak heap / peak live = %.2f\n",
+           heap ? 100.0 * (heap - live) / heap : 0.0,
+           peak_live ? (double)peak_heap / peak_live : 0.0);
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        printf("peak RSS = %ld KB\n", usage.ru_maxrss);
+    }
 }
 
+// Small demo; build with -DMEM_MANAGER_NO_MAIN to link the allocator into
+// another program, such as the benchmarks
+#ifndef MEM_MANAGER_NO_MAIN
 int main() {
     void *p1 = malloc(100);
     void *p2 = malloc(200);
@@ -162,4 +873,5 @@ int main() {
     free(p2);
     print_mem_list();
     return 0;
-}
\ No newline at end of file
+}
+#endif  // MEM_MANAGER_NO_MAIN
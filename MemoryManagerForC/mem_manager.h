@@ -6,21 +6,55 @@
 // Align to 16 bytes
 typedef char ALIGN[16];
 
+// Every block is laid out as header, payload, footer. The footer repeats the
+// payload size (a boundary tag), so the block before any other can be found
+// from its footer. Header plus footer is 32 bytes and payload sizes are
+// multiples of 16, so with the first header placed 8 bytes past a 16-byte
+// boundary every payload is aligned to 16 bytes.
 union header {
     struct {
-        size_t size;
+        size_t size;      // payload size
         unsigned is_free;
-        union header* next;
+        unsigned is_mmapped;  // has a mapping of its own rather than being in the heap
+        union header* next;  // next block in address order
     }s;
-    ALIGN stub;  // The header must be aligned to 16 bytes
+    ALIGN stub;
 };
 
 typedef union header header_t;
 
+typedef size_t footer_t;
+
 void* malloc(size_t size);
 void free(void* block);
 void* calloc(size_t num, size_t size);
 void* realloc(void* block, size_t size);
 void print_mem_list();
 
+// Blocks of more than threshold bytes (128 KB by default) get an mmap of
+// their own, which free gives straight back with munmap. Blocks of up to
+// 1 KB always come from the heap.
+void set_mmap_threshold(size_t threshold);
+
+// Pools of fixed-size objects, for structures allocated and freed often
+// (list and hash nodes, connections). Objects are cut from page-sized slabs
+// mapped for the pool and carry no header; a free object holds the link to
+// the next in the pool's free list. An object of up to a cache line takes a
+// power of two bytes, so it never straddles two lines, and a larger one takes
+// whole lines unless that would waste more than an eighth of it. A pool is
+// not locked: use each from one thread at a time.
+typedef struct mem_pool mem_pool_t;
+
+// A pool of objects of size bytes, or NULL if size is 0 or memory runs out
+mem_pool_t* pool_create(size_t size);
+
+// An object from the pool, or NULL if memory runs out
+void* pool_alloc(mem_pool_t* pool);
+
+// Return an object to the pool it came from
+void pool_free(mem_pool_t* pool, void* object);
+
+// Unmap every slab of the pool, including objects still in use
+void pool_destroy(mem_pool_t* pool);
+
 #endif  // MEM_MANAGER_H
\ No newline at end of file